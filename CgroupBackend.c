@@ -0,0 +1,542 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CgroupBackend.h"
+#include "Process.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "memwatch.h"
+
+const char* BACKEND_ENV_VAR = "PROCNANNYBACKEND";
+const char* CGROUP_SUBTREE_ENV_VAR = "PROCNANNYCGROUP";
+
+// With PROCNANNYBACKEND=cgroup, every process that a rule matches is moved into a leaf cgroup of its own, named
+// after its pid and start time, under a subtree delegated to procnanny (PROCNANNYCGROUP, or procnanny under the
+// root of the cgroup v2 hierarchy). Everything it starts from then on lands in the same leaf, so the memory and
+// CPU use of the lot are one read of memory.current and one of cpu.stat, however many processes there are.
+// When the last of them exits, the kernel modifies the leaf's cgroup.events, which is watched through inotify,
+// so exits are noticed without polling. Leaves are removed once empty, and the processes still in one when
+// procnanny stops are moved back to the cgroups they came from.
+
+#define CGROUP_BACKEND "cgroup"
+#define DEFAULT_CGROUP_ROOT "/sys/fs/cgroup"
+#define DEFAULT_SUBTREE_NAME "procnanny"
+#define STARTING_LEAF_CAPACITY 64
+#define EVENT_BUFFER_SIZE 4096
+// The period of the cpu.max that throttleCgroup sets
+#define CPU_PERIOD_MICROS 100000
+
+typedef struct
+{
+	pid_t pid;
+	unsigned long long startTime;
+	// The inotify watch on its cgroup.events
+	int watch;
+	// The cgroup the process was moved out of, relative to the root
+	char* origin;
+	// Whether the process had no children yet when it was moved, so that the leaf holds everything it started
+	bool isWhole;
+} Leaf;
+
+static bool isTried = false;
+static bool isStarted = false;
+static char subtree[MAX_CGROUP_PATH];
+// The subtree relative to the root, or NULL if it isn't under it
+static const char* subtreeInRoot = NULL;
+static int eventFD = -1;
+static Leaf* leaves = NULL;
+static int leafCount = 0;
+static int leafCapacity = 0;
+
+// Where the cgroup v2 hierarchy is mounted: /sys/fs/cgroup, or /sys/fs/cgroup/unified on hybrid systems
+const char* getCgroupRoot()
+{
+    static char root[MAX_CGROUP_PATH] = "";
+    if (root[0] != '\0')
+    {
+        return root;
+    }
+    snprintf(root, sizeof(root), "%s", DEFAULT_CGROUP_ROOT);
+    FILE* mounts = fopen("/proc/self/mounts", "r");
+    if (mounts == NULL)
+    {
+        return root;
+    }
+    char line[MAX_CGROUP_PATH];
+    while (fgets(line, sizeof(line), mounts) != NULL)
+    {
+        char mountPoint[MAX_CGROUP_PATH];
+        char type[32];
+        if (sscanf(line, "%*s %4095s %31s", mountPoint, type) == 2 && strcmp(type, "cgroup2") == 0)
+        {
+            snprintf(root, sizeof(root), "%s", mountPoint);
+            break;
+        }
+    }
+    fclose(mounts);
+    return root;
+}
+
+//private
+// The leaf's directory, or a file in it if name isn't empty
+void getLeafPath(pid_t pid, unsigned long long startTime, const char* name, char* path, int size)
+{
+    snprintf(path, size, "%s/%d-%llu%s%s", subtree, (int)pid, startTime, name[0] == '\0' ? "" : "/", name);
+}
+
+//private
+// 0 if written, or the errno of the open or write that failed (taken before close can change it)
+int writeCgroupFile(const char* path, const char* value)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+    int length = strlen(value);
+    ssize_t written = write(fd, value, length);
+    int error = written == length ? 0 : written < 0 ? errno : EIO;
+    close(fd);
+    return error;
+}
+
+//private
+// The length read, or -1
+int readCgroupFile(const char* path, char* buffer, int size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int length = read(fd, buffer, size - 1);
+    close(fd);
+    buffer[length < 0 ? 0 : length] = '\0';
+    return length;
+}
+
+//private
+bool isLeafPopulated(pid_t pid, unsigned long long startTime)
+{
+    char path[MAX_CGROUP_PATH];
+    char events[256];
+    getLeafPath(pid, startTime, "cgroup.events", path, sizeof(path));
+    return readCgroupFile(path, events, sizeof(events)) > 0 && strstr(events, "populated 1") != NULL;
+}
+
+//private
+// Leaves that a previous run left behind. Those that still have processes in them can't be removed, and stay.
+void removeStaleLeaves()
+{
+    DIR* directory = opendir(subtree);
+    if (directory == NULL)
+    {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        char path[2*MAX_CGROUP_PATH];
+        snprintf(path, sizeof(path), "%s/%s", subtree, entry->d_name);
+        rmdir(path);
+    }
+    closedir(directory);
+}
+
+// True if PROCNANNYBACKEND=cgroup, and the subtree could be set up. Only tries once.
+bool startCgroupBackend()
+{
+    if (isTried)
+    {
+        return isStarted;
+    }
+    isTried = true;
+    const char* backend = getenv(BACKEND_ENV_VAR);
+    if (backend == NULL || !compareStrings(backend, CGROUP_BACKEND))
+    {
+        return false;
+    }
+
+    const char* configured = getenv(CGROUP_SUBTREE_ENV_VAR);
+    const char* root = getCgroupRoot();
+    if (configured != NULL && configured[0] != '\0')
+    {
+        snprintf(subtree, sizeof(subtree), "%s", configured);
+    }
+    else
+    {
+        snprintf(subtree, sizeof(subtree), "%s/%s", root, DEFAULT_SUBTREE_NAME);
+    }
+    int rootLength = strlen(root);
+    if (strncmp(subtree, root, rootLength) == 0 && subtree[rootLength] == '/')
+    {
+        subtreeInRoot = subtree + rootLength;
+    }
+
+    LogReport report;
+    char path[2*MAX_CGROUP_PATH];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", subtree);
+    if ((mkdir(subtree, 0755) != 0 && errno != EEXIST) || access(path, W_OK) != 0
+        || (eventFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    {
+        report.message = "The cgroup backend is not available. Monitoring through worker processes.";
+        report.type = WARNING;
+        saveLogReport(report);
+        return false;
+    }
+    // Without the memory controller, there is no memory.current, and memory use is read from /proc as usual
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", subtree);
+    writeCgroupFile(path, "+memory");
+    writeCgroupFile(path, "+cpu");
+    removeStaleLeaves();
+    isStarted = true;
+    report.message = "Monitoring through cgroups.";
+    report.type = INFO;
+    saveLogReport(report);
+    return true;
+}
+
+// The absolute path of the subtree, or NULL if the backend isn't started
+const char* getCgroupSubtree()
+{
+    return isStarted ? subtree : NULL;
+}
+
+//private
+bool isInSubtree(const char* path)
+{
+    if (subtreeInRoot == NULL)
+    {
+        return false;
+    }
+    int length = strlen(subtreeInRoot);
+    return strncmp(path, subtreeInRoot, length) == 0 && (path[length] == '\0' || path[length] == '/');
+}
+
+//private
+bool growLeaves()
+{
+    int capacity = leafCapacity == 0 ? STARTING_LEAF_CAPACITY : leafCapacity*2;
+    Leaf* grown = (Leaf*)realloc(leaves, capacity*sizeof(Leaf));
+    LogReport report;
+    if (!checkMallocResult(grown, &report))
+    {
+        saveLogReport(report);
+        return false;
+    }
+    leaves = grown;
+    leafCapacity = capacity;
+    return true;
+}
+
+//private
+int findLeaf(pid_t pid, unsigned long long startTime)
+{
+    int i;
+    for (i = 0; i < leafCount; ++i)
+    {
+        if (leaves[i].pid == pid && leaves[i].startTime == startTime)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//private
+// Only exits end leaves, so there are few events to look up, and they don't need an index
+int findWatchedLeaf(int watch)
+{
+    int i;
+    for (i = 0; i < leafCount; ++i)
+    {
+        if (leaves[i].watch == watch)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//private
+// The cgroup.procs of a cgroup that a process came from
+void getOriginProcsPath(const char* origin, char* path, int size)
+{
+    snprintf(path, size, "%s%s/cgroup.procs", getCgroupRoot(), strcmp(origin, "/") == 0 ? "" : origin);
+}
+
+//private
+bool isStartedAt(pid_t pid, unsigned long long startTime)
+{
+    Process process;
+    initProcessQuery(&process, pid, NULL);
+    unsigned long long actual;
+    bool isSame = getProcessStartTime(&process, &actual) && actual == startTime;
+    clearProcessQuery(&process);
+    return isSame;
+}
+
+//private
+// Moves whatever is still in the leaf back to where the process came from, and removes the leaf
+void removeLeaf(int index)
+{
+    Leaf* leaf = &leaves[index];
+    char path[MAX_CGROUP_PATH];
+    char procs[16384];
+    getLeafPath(leaf->pid, leaf->startTime, "cgroup.procs", path, sizeof(path));
+    if (readCgroupFile(path, procs, sizeof(procs)) > 0)
+    {
+        char originProcs[2*MAX_CGROUP_PATH];
+        getOriginProcsPath(leaf->origin, originProcs, sizeof(originProcs));
+        char* line = strtok(procs, "\n");
+        while (line != NULL)
+        {
+            writeCgroupFile(originProcs, line);
+            line = strtok(NULL, "\n");
+        }
+    }
+    if (leaf->watch >= 0)
+    {
+        inotify_rm_watch(eventFD, leaf->watch);
+    }
+    getLeafPath(leaf->pid, leaf->startTime, "", path, sizeof(path));
+    rmdir(path);
+    free(leaf->origin);
+    leaves[index] = leaves[--leafCount];
+}
+
+//private
+void countChild(pid_t child, void* count)
+{
+    ++*(int*)count;
+}
+
+// Moves the process into a leaf of its own. False if the backend isn't started, the process is already in the
+// subtree (as it is when its parent was placed before it), or it couldn't be moved.
+bool placeInCgroup(pid_t pid, unsigned long long startTime)
+{
+    if (!isStarted || (leafCount == leafCapacity && !growLeaves()))
+    {
+        return false;
+    }
+    // Checked once the pidfd is open, so that the pidfd is known to be for the right process
+    int pidFD = openProcessFD(pid);
+    char origin[MAX_CGROUP_PATH];
+    if (!isStartedAt(pid, startTime) || !readProcessCgroup(pid, origin, sizeof(origin)) || isInSubtree(origin))
+    {
+        if (pidFD >= 0)
+        {
+            close(pidFD);
+        }
+        return false;
+    }
+    char path[MAX_CGROUP_PATH];
+    getLeafPath(pid, startTime, "", path, sizeof(path));
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    {
+        if (pidFD >= 0)
+        {
+            close(pidFD);
+        }
+        return false;
+    }
+    char value[16];
+    snprintf(value, sizeof(value), "%d", (int)pid);
+    getLeafPath(pid, startTime, "cgroup.procs", path, sizeof(path));
+    bool isMoved = writeCgroupFile(path, value) == 0;
+    // cgroup.procs only takes a pid. If the process is still alive after the write, that was its pid all along;
+    // if not, the pid may have been reused in between, and whatever took it over goes back out.
+    bool isSame = pidFD >= 0 ? signalProcess(pid, pidFD, 0) : isStartedAt(pid, startTime);
+    if (pidFD >= 0)
+    {
+        close(pidFD);
+    }
+    if (!isMoved || !isSame)
+    {
+        char moved[MAX_CGROUP_PATH];
+        if (isMoved && readProcessCgroup(pid, moved, sizeof(moved)) && isInSubtree(moved))
+        {
+            char originProcs[2*MAX_CGROUP_PATH];
+            getOriginProcsPath(origin, originProcs, sizeof(originProcs));
+            writeCgroupFile(originProcs, value);
+        }
+        getLeafPath(pid, startTime, "", path, sizeof(path));
+        rmdir(path);
+        return false;
+    }
+
+    Leaf* leaf = &leaves[leafCount++];
+    leaf->pid = pid;
+    leaf->startTime = startTime;
+    leaf->origin = copyString(origin);
+    // Counted after the move, as whatever it starts from then on is in the leaf anyway
+    int children = 0;
+    forEachChild(pid, countChild, &children);
+    leaf->isWhole = children == 0;
+    getLeafPath(pid, startTime, "cgroup.events", path, sizeof(path));
+    leaf->watch = inotify_add_watch(eventFD, path, IN_MODIFY);
+    if (leaf->watch < 0 || !isLeafPopulated(pid, startTime))
+    {
+        // Gone before the watch was set up, or it can't be watched
+        removeLeaf(leafCount - 1);
+        return false;
+    }
+    return true;
+}
+
+// The memory (in KiB) and CPU time (in microseconds) used by everything in the process's leaf. Either is left as
+// it is if the leaf doesn't have it. False if it has neither.
+bool readCgroupUsage(pid_t pid, unsigned long long startTime, unsigned long* rss, unsigned long long* cpuTime)
+{
+    char path[MAX_CGROUP_PATH];
+    char buffer[1024];
+    bool isRead = false;
+    getLeafPath(pid, startTime, "memory.current", path, sizeof(path));
+    if (readCgroupFile(path, buffer, sizeof(buffer)) > 0)
+    {
+        *rss = strtoul(buffer, NULL, 10)/1024;
+        isRead = true;
+    }
+    getLeafPath(pid, startTime, "cpu.stat", path, sizeof(path));
+    char* usage;
+    if (readCgroupFile(path, buffer, sizeof(buffer)) > 0 && (usage = strstr(buffer, "usage_usec ")) != NULL)
+    {
+        *cpuTime = strtoull(usage + strlen("usage_usec "), NULL, 10);
+        isRead = true;
+    }
+    return isRead;
+}
+
+// Caps the process's leaf at cpuPercent of one CPU through cpu.max, and at memoryHigh bytes through memory.high,
+// beyond which the kernel reclaims rather than lets it grow. False if there is no cpu.max to write (the cpu
+// controller isn't enabled for the subtree).
+bool throttleCgroup(pid_t pid, unsigned long long startTime, unsigned int cpuPercent, unsigned long long memoryHigh)
+{
+    char path[MAX_CGROUP_PATH];
+    char value[64];
+    getLeafPath(pid, startTime, "memory.high", path, sizeof(path));
+    snprintf(value, sizeof(value), "%llu", memoryHigh);
+    writeCgroupFile(path, value);
+    getLeafPath(pid, startTime, "cpu.max", path, sizeof(path));
+    snprintf(value, sizeof(value), "%u %u", cpuPercent*(CPU_PERIOD_MICROS/100), CPU_PERIOD_MICROS);
+    return writeCgroupFile(path, value) == 0;
+}
+
+// Has the kernel reclaim that much of the memory charged to the process's leaf, through memory.reclaim (Linux
+// 5.19). False if the leaf has no memory.reclaim. The kernel may reclaim less than asked.
+bool reclaimCgroup(pid_t pid, unsigned long long startTime, unsigned long long bytes)
+{
+    char path[MAX_CGROUP_PATH];
+    char value[32];
+    getLeafPath(pid, startTime, "memory.reclaim", path, sizeof(path));
+    snprintf(value, sizeof(value), "%llu", bytes);
+    // EAGAIN if it fell short
+    int error = writeCgroupFile(path, value);
+    return error == 0 || error == EAGAIN;
+}
+
+// Kills everything in the process's leaf at once, through cgroup.kill (Linux 5.14). Only leaves that procnanny
+// made are written to, so nothing outside what the process started can go with it. False if the process has no
+// leaf, it had children from before it was placed (which are still outside the leaf), or the kernel has no
+// cgroup.kill.
+bool killCgroup(pid_t pid, unsigned long long startTime)
+{
+    int index = findLeaf(pid, startTime);
+    if (index < 0 || !leaves[index].isWhole)
+    {
+        return false;
+    }
+    char path[MAX_CGROUP_PATH];
+    getLeafPath(pid, startTime, "cgroup.kill", path, sizeof(path));
+    return writeCgroupFile(path, "1") == 0;
+}
+
+// For a process that is no longer tracked. Whatever is still in its leaf is moved back out.
+void releaseCgroup(pid_t pid, unsigned long long startTime)
+{
+    int index = findLeaf(pid, startTime);
+    if (index >= 0)
+    {
+        removeLeaf(index);
+    }
+}
+
+// Readable when a leaf may have emptied, for handleCgroupEvents. -1 if the backend isn't started.
+int getCgroupEventFD()
+{
+    return eventFD;
+}
+
+// Removes the leaves that have emptied since the last call, and calls onExit for each. Returns how many
+// of those calls finished a kill.
+int handleCgroupEvents(CgroupExitHandler onExit)
+{
+    char buffer[EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int finished = 0;
+    int length;
+    while (eventFD >= 0 && (length = read(eventFD, buffer, sizeof(buffer))) > 0)
+    {
+        char* position = buffer;
+        while (position < buffer + length)
+        {
+            struct inotify_event* event = (struct inotify_event*)position;
+            position += sizeof(struct inotify_event) + event->len;
+            int i = findWatchedLeaf(event->wd);
+            if (i < 0 || isLeafPopulated(leaves[i].pid, leaves[i].startTime))
+            {
+                continue;
+            }
+            pid_t pid = leaves[i].pid;
+            unsigned long long startTime = leaves[i].startTime;
+            removeLeaf(i);
+            if (onExit(pid, startTime))
+            {
+                ++finished;
+            }
+        }
+    }
+    return finished;
+}
+
+// Moves every process still placed back out, and removes the leaves
+void stopCgroupBackend()
+{
+    while (leafCount > 0)
+    {
+        removeLeaf(leafCount - 1);
+    }
+    free(leaves);
+    leaves = NULL;
+    leafCapacity = 0;
+    if (eventFD >= 0)
+    {
+        close(eventFD);
+        eventFD = -1;
+    }
+    isStarted = false;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CGROUP_BACKEND_H__
+#define __CGROUP_BACKEND_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+#define MAX_CGROUP_PATH 4096
+
+// Called with each placed process whose cgroup has emptied. True if that finished a kill.
+typedef bool (*CgroupExitHandler)(pid_t pid, unsigned long long startTime);
+
+const char* getCgroupRoot();
+bool startCgroupBackend();
+const char* getCgroupSubtree();
+bool placeInCgroup(pid_t pid, unsigned long long startTime);
+bool readCgroupUsage(pid_t pid, unsigned long long startTime, unsigned long* rss, unsigned long long* cpuTime);
+bool throttleCgroup(pid_t pid, unsigned long long startTime, unsigned int cpuPercent, unsigned long long memoryHigh);
+bool reclaimCgroup(pid_t pid, unsigned long long startTime, unsigned long long bytes);
+bool killCgroup(pid_t pid, unsigned long long startTime);
+void releaseCgroup(pid_t pid, unsigned long long startTime);
+int getCgroupEventFD();
+int handleCgroupEvents(CgroupExitHandler onExit);
+void stopCgroupBackend();
+#endif
\ No newline at end of file
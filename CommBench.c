@@ -0,0 +1,122 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CommMatcher.h"
+#include "MonitorRequest.h"
+#include "RuleSet.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "memwatch.h"
+
+// procnanny-bench (make bench)
+// Times the two ways that isCommCandidate can look a comm up among the exact names of a config: a SIMD scan of
+// all of their comms, for 1 to MAX_BENCH_KEYS of them, and a probe of the commSlots hash, which costs about the
+// same whatever their number. MAX_SIMD_COMM_KEYS in CommMatcher.h should be the last count at which the scan
+// is still faster on the hosts procnanny runs on. Each lookup is of one of six comms, two of which are there.
+// Only the lookups are timed: the scan's keys for those comms are made beforehand. Built with -O2.
+
+#define MAX_BENCH_KEYS 64
+#define LOOKUPS 4000000
+
+static const char* PROBES[] = {"bash", "sshd", "daemon3", "kworker/0:1", "daemon1", "nginx"};
+#define PROBE_COUNT (sizeof(PROBES)/sizeof(PROBES[0]))
+
+//private
+double getNanoseconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1e9 + now.tv_nsec;
+}
+
+//private
+// What isCommCandidate does for a config with at most MAX_SIMD_COMM_KEYS comms, for any number of them
+double timeScan(const CommKey* keys, unsigned int count)
+{
+    CommKey probes[PROBE_COUNT];
+    unsigned int i;
+    for (i = 0; i < PROBE_COUNT; ++i)
+    {
+        makeCommKey(&probes[i], PROBES[i], strlen(PROBES[i]));
+    }
+
+    volatile unsigned int hits = 0;
+    double start = getNanoseconds();
+    for (i = 0; i < LOOKUPS; ++i)
+    {
+        hits += containsCommKey(keys, count, &probes[i%PROBE_COUNT]);
+    }
+    return (getNanoseconds() - start)/LOOKUPS;
+}
+
+//private
+// isCommCandidate itself, on a config with more than MAX_SIMD_COMM_KEYS comms, so that it probes the hash
+double timeHash()
+{
+    RuleSetSizes sizes;
+    memset(&sizes, 0, sizeof(RuleSetSizes));
+    sizes.requestCount = MAX_BENCH_KEYS;
+    sizes.namesSize = MAX_BENCH_KEYS*32;
+    RuleSet* set = allocateRuleSet(&sizes);
+    if (set == NULL)
+    {
+        return 0.0;
+    }
+    RequestPredicates predicates;
+    memset(&predicates, 0, sizeof(RequestPredicates));
+    char name[32];
+    int i;
+    for (i = 0; i < MAX_BENCH_KEYS; ++i)
+    {
+        int length = snprintf(name, sizeof(name), "/usr/bin/daemon%d", i);
+        addMonitorRequest(set, EXACT_NAME, name, length, 10, &predicates);
+    }
+    finishRuleSet(set, NULL);
+
+    volatile unsigned int hits = 0;
+    double start = getNanoseconds();
+    unsigned int lookup;
+    for (lookup = 0; lookup < LOOKUPS; ++lookup)
+    {
+        hits += isCommCandidate(PROBES[lookup%PROBE_COUNT], set);
+    }
+    double elapsed = (getNanoseconds() - start)/LOOKUPS;
+    destroyRuleSet(set);
+    return elapsed;
+}
+
+int main()
+{
+    CommKey keys[MAX_BENCH_KEYS];
+    char comm[32];
+    int i;
+    for (i = 0; i < MAX_BENCH_KEYS; ++i)
+    {
+        int length = snprintf(comm, sizeof(comm), "daemon%d", i);
+        makeCommKey(&keys[i], comm, length);
+    }
+
+    double hash = timeHash();
+    printf("comms  scan (ns)  hash (ns)\n");
+    unsigned int count;
+    for (count = 1; count <= MAX_BENCH_KEYS; count = count < 8 ? count*2 : count + 4)
+    {
+        printf("%5u  %9.1f  %9.1f\n", count, timeScan(keys, count), hash);
+    }
+    printf("MAX_SIMD_COMM_KEYS is %d.\n", MAX_SIMD_COMM_KEYS);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CommMatcher.h"
+#include <string.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_SIMD
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+#include "memwatch.h"
+
+// Comms are at most 15 characters, so a NUL padded comm is one 16 byte vector and comparing two of them is a
+// single compare and movemask. The widest implementation the CPU supports is picked on first use. On ARM, NEON
+// is used whenever the build targets it (every AArch64 build does).
+
+typedef bool (*CommKeyScanner)(const CommKey* keys, unsigned int count, const CommKey* key);
+
+void makeCommKey(CommKey* key, const char* comm, int length)
+{
+    memset(key->bytes, 0, COMM_KEY_SIZE);
+    memcpy(key->bytes, comm, length < COMM_KEY_SIZE - 1 ? length : COMM_KEY_SIZE - 1);
+}
+
+//private
+bool scanCommKeysScalar(const CommKey* keys, unsigned int count, const CommKey* key)
+{
+    uint64_t low;
+    uint64_t high;
+    memcpy(&low, key->bytes, 8);
+    memcpy(&high, key->bytes + 8, 8);
+    unsigned int i;
+    for (i = 0; i < count; ++i)
+    {
+        uint64_t keyLow;
+        uint64_t keyHigh;
+        memcpy(&keyLow, keys[i].bytes, 8);
+        memcpy(&keyHigh, keys[i].bytes + 8, 8);
+        if (((keyLow ^ low) | (keyHigh ^ high)) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef HAS_X86_SIMD
+//private
+__attribute__((target("sse2")))
+bool scanCommKeysSSE2(const CommKey* keys, unsigned int count, const CommKey* key)
+{
+    __m128i needle = _mm_loadu_si128((const __m128i*)key->bytes);
+    unsigned int i;
+    for (i = 0; i < count; ++i)
+    {
+        __m128i candidate = _mm_loadu_si128((const __m128i*)keys[i].bytes);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(candidate, needle)) == 0xFFFF)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//private
+// Two keys per compare
+__attribute__((target("avx2")))
+bool scanCommKeysAVX2(const CommKey* keys, unsigned int count, const CommKey* key)
+{
+    __m128i half = _mm_loadu_si128((const __m128i*)key->bytes);
+    __m256i needle = _mm256_broadcastsi128_si256(half);
+    unsigned int i;
+    for (i = 0; i + 2 <= count; i += 2)
+    {
+        __m256i candidates = _mm256_loadu_si256((const __m256i*)keys[i].bytes);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(candidates, needle));
+        if ((mask & 0xFFFFu) == 0xFFFFu || (mask >> 16) == 0xFFFFu)
+        {
+            return true;
+        }
+    }
+    return i < count && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)keys[i].bytes), half)) == 0xFFFF;
+}
+#endif
+
+#ifdef __ARM_NEON
+//private
+// NEON has no movemask: the compare matched every byte when both 64 bit halves of its result are all ones
+bool scanCommKeysNEON(const CommKey* keys, unsigned int count, const CommKey* key)
+{
+    uint8x16_t needle = vld1q_u8((const uint8_t*)key->bytes);
+    unsigned int i;
+    for (i = 0; i < count; ++i)
+    {
+        uint64x2_t equal = vreinterpretq_u64_u8(vceqq_u8(vld1q_u8((const uint8_t*)keys[i].bytes), needle));
+        if ((vgetq_lane_u64(equal, 0) & vgetq_lane_u64(equal, 1)) == UINT64_MAX)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+//private
+CommKeyScanner chooseCommKeyScanner()
+{
+#ifdef HAS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return scanCommKeysAVX2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return scanCommKeysSSE2;
+    }
+#endif
+#ifdef __ARM_NEON
+    return scanCommKeysNEON;
+#endif
+    return scanCommKeysScalar;
+}
+
+// Whether key is one of keys[0..count)
+bool containsCommKey(const CommKey* keys, unsigned int count, const CommKey* key)
+{
+    static CommKeyScanner scanner = NULL;
+    if (scanner == NULL)
+    {
+        scanner = chooseCommKeyScanner();
+    }
+    return scanner(keys, count, key);
+}
\ No newline at end of file
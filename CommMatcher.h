@@ -0,0 +1,36 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __COMM_MATCHER_H__
+#define __COMM_MATCHER_H__
+
+#include <stdbool.h>
+
+// A comm padded with NULs to exactly one 16 byte vector
+#define COMM_KEY_SIZE 16
+
+// Up to this many distinct comms, scanning them all with SIMD beats hashing the comm and probing. Set from
+// make bench (-O2, lookups only). Where the scan has been seen to lose first, it was at about 12 comms.
+#define MAX_SIMD_COMM_KEYS 12
+
+typedef struct
+{
+	char bytes[COMM_KEY_SIZE];
+} CommKey;
+
+void makeCommKey(CommKey* key, const char* comm, int length);
+bool containsCommKey(const CommKey* keys, unsigned int count, const CommKey* key);
+#endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Logging.h"
+#include "MonitorRequest.h"
+#include "RuleSet.h"
+#include <stdio.h>
+#include "memwatch.h"
+
+// procnanny-compile <config> <image>
+// Compiles a config ahead of time into an image that procnanny can be pointed at instead of the config.
+int main(int argc, char** argv)
+{
+    LogReport report;
+    if (argc != 3)
+    {
+        report.message = "Usage: procnanny-compile <config> <image>";
+        report.type = ERROR;
+        printLogReport(report);
+        return -1;
+    }
+
+    report.message = (char*)NULL;
+    RuleSet* set = getProcessesToMonitor(argv[1], NULL, &report);
+    if (set == NULL)
+    {
+        if (report.message == NULL)
+        {
+            report.message = "The config is empty.";
+            report.type = ERROR;
+        }
+        printLogReport(report);
+        return -1;
+    }
+
+    if (set->isPrecompiled)
+    {
+        report.message = "The config is already compiled.";
+        report.type = ERROR;
+        printLogReport(report);
+        destroyRuleSet(set);
+        return -1;
+    }
+
+    bool saved = saveRuleSetImage(set, argv[2], &report);
+    if (!saved)
+    {
+        printLogReport(report);
+    }
+    else
+    {
+        printf("Compiled %u rule(s) from %s into %s.\n", set->requestCount, argv[1], argv[2]);
+    }
+    destroyRuleSet(set);
+    return saved ? 0 : -1;
+}
\ No newline at end of file
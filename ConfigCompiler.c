@@ -0,0 +1,238 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ConfigCompiler.h"
+#include "MonitorRequest.h"
+#include "Utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include "memwatch.h"
+
+// Config reloads are compiled on a background thread, so the monitoring loop never blocks on a big config.
+//
+// The thread must not allocate through memwatch (it is not thread safe), nor log (the log isn't either),
+// so RuleSets live in their own mappings and errors are handed to the main thread in the report.
+//
+// The main thread is the only one that swaps the current set. A replaced set is retired, and unmapped
+// once the compiler thread (the only other reader, which diffs new configs against the current set)
+// can no longer be looking at it. This is done with epochs, like RCU: the compiler records the epoch it
+// entered its read section in, and a set retired at a later epoch than that must wait for it to leave.
+
+typedef struct retiredRuleSet
+{
+    RuleSet* set;
+    unsigned long retiredAt;
+    struct retiredRuleSet* next;
+} RetiredRuleSet;
+
+struct
+{
+    pthread_t thread;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeUp;
+    bool compileRequested;
+    bool stopping;
+    char* configPath;
+    // The compiler writes a byte here whenever it has a set (or an error) for the main thread
+    int notifyFD[2];
+
+    _Atomic(RuleSet*) current;
+    _Atomic(RuleSet*) pending;
+    _Atomic(const char*) pendingError;
+    atomic_ulong epoch;
+    // 0 while the compiler isn't looking at the current set
+    atomic_ulong readerEpoch;
+    RetiredRuleSet* retired;
+} compiler = { .running = false, .lock = PTHREAD_MUTEX_INITIALIZER, .wakeUp = PTHREAD_COND_INITIALIZER,
+               .notifyFD = { -1, -1 }, .epoch = 1 };
+
+//private
+void enterReadSection()
+{
+    atomic_store(&compiler.readerEpoch, atomic_load(&compiler.epoch));
+}
+
+//private
+void exitReadSection()
+{
+    atomic_store(&compiler.readerEpoch, 0);
+}
+
+//private
+void compileConfig()
+{
+    LogReport report;
+    enterReadSection();
+    RuleSet* set = getProcessesToMonitor(compiler.configPath, atomic_load(&compiler.current), &report);
+    exitReadSection();
+
+    if (set == NULL)
+    {
+        atomic_store(&compiler.pendingError, (const char*)report.message);
+    }
+    else
+    {
+        // A set that was never taken was never seen by the main thread either
+        destroyRuleSet(atomic_exchange(&compiler.pending, set));
+    }
+
+    char notification = 1;
+    write(compiler.notifyFD[1], &notification, 1);
+}
+
+//private
+void* compilerMain(void* unused)
+{
+    while (true)
+    {
+        pthread_mutex_lock(&compiler.lock);
+        while (!compiler.compileRequested && !compiler.stopping)
+        {
+            pthread_cond_wait(&compiler.wakeUp, &compiler.lock);
+        }
+        bool stopping = compiler.stopping;
+        compiler.compileRequested = false;
+        pthread_mutex_unlock(&compiler.lock);
+
+        if (stopping)
+        {
+            return NULL;
+        }
+        compileConfig();
+    }
+}
+
+bool startConfigCompiler(const char* configPath, RuleSet* initial)
+{
+    atomic_store(&compiler.current, initial);
+    if (pipe(compiler.notifyFD) < 0)
+    {
+        return false;
+    }
+    fcntl(compiler.notifyFD[0], F_SETFL, O_NONBLOCK);
+    compiler.configPath = copyString((char*)configPath);
+    compiler.stopping = false;
+    compiler.compileRequested = false;
+    compiler.running = pthread_create(&compiler.thread, NULL, compilerMain, NULL) == 0;
+    if (!compiler.running)
+    {
+        LogReport report;
+        report.message = "Failed to start the config compiler thread. Reloads will block monitoring.";
+        report.type = WARNING;
+        saveLogReport(report);
+    }
+    return true;
+}
+
+void stopConfigCompiler()
+{
+    if (compiler.running)
+    {
+        pthread_mutex_lock(&compiler.lock);
+        compiler.stopping = true;
+        pthread_cond_signal(&compiler.wakeUp);
+        pthread_mutex_unlock(&compiler.lock);
+        pthread_join(compiler.thread, NULL);
+        compiler.running = false;
+    }
+
+    destroyRuleSet(atomic_exchange(&compiler.pending, NULL));
+    destroyRuleSet(atomic_exchange(&compiler.current, NULL));
+    reclaimRuleSets();
+    if (compiler.notifyFD[0] >= 0)
+    {
+        close(compiler.notifyFD[0]);
+        close(compiler.notifyFD[1]);
+        compiler.notifyFD[0] = -1;
+        compiler.notifyFD[1] = -1;
+    }
+    free(compiler.configPath);
+    compiler.configPath = NULL;
+}
+
+void requestConfigCompile()
+{
+    if (!compiler.running)
+    {
+        // No thread. Compile right here instead.
+        compileConfig();
+        return;
+    }
+    pthread_mutex_lock(&compiler.lock);
+    compiler.compileRequested = true;
+    pthread_cond_signal(&compiler.wakeUp);
+    pthread_mutex_unlock(&compiler.lock);
+}
+
+int getConfigCompilerFD()
+{
+    return compiler.notifyFD[0];
+}
+
+// The newest set compiled since the last call, if any. A failed compile puts its error in the report.
+RuleSet* takeCompiledRuleSet(LogReport* report)
+{
+    char drain[64];
+    while (compiler.notifyFD[0] >= 0 && read(compiler.notifyFD[0], drain, sizeof(drain)) > 0);
+
+    report->message = (char*)atomic_exchange(&compiler.pendingError, NULL);
+    report->type = ERROR;
+    return atomic_exchange(&compiler.pending, NULL);
+}
+
+RuleSet* getCurrentRuleSet()
+{
+    return atomic_load(&compiler.current);
+}
+
+// Main thread only
+void swapRuleSet(RuleSet* next)
+{
+    RuleSet* old = atomic_exchange(&compiler.current, next);
+    if (old == NULL)
+    {
+        return;
+    }
+
+    RetiredRuleSet* retired = (RetiredRuleSet*)malloc(sizeof(RetiredRuleSet));
+    retired->set = old;
+    retired->retiredAt = atomic_fetch_add(&compiler.epoch, 1) + 1;
+    retired->next = compiler.retired;
+    compiler.retired = retired;
+}
+
+// Main thread only. Unmaps the retired sets the compiler thread can't be reading anymore.
+void reclaimRuleSets()
+{
+    unsigned long readerEpoch = atomic_load(&compiler.readerEpoch);
+    RetiredRuleSet** link = &compiler.retired;
+    while (*link != NULL)
+    {
+        RetiredRuleSet* retired = *link;
+        if (readerEpoch == 0 || readerEpoch >= retired->retiredAt)
+        {
+            *link = retired->next;
+            destroyRuleSet(retired->set);
+            free(retired);
+        }
+        else
+        {
+            link = &retired->next;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CONFIG_COMPILER_H__
+#define __CONFIG_COMPILER_H__
+
+#include "RuleSet.h"
+#include "Logging.h"
+#include <stdbool.h>
+
+bool startConfigCompiler(const char* configPath, RuleSet* initial);
+void stopConfigCompiler();
+void requestConfigCompile();
+int getConfigCompilerFD();
+RuleSet* takeCompiledRuleSet(LogReport* report);
+
+RuleSet* getCurrentRuleSet();
+void swapRuleSet(RuleSet* next);
+void reclaimRuleSets();
+#endif
@@ -0,0 +1,192 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ConfigWatcher.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <string.h>
+#include <libgen.h>
+#include "memwatch.h"
+
+#define DEFAULT_DEBOUNCE_MS 500
+// Only a finished write counts: an IN_MODIFY would reload a config that is still being written
+#define RELOAD_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+const char* AUTORELOAD_ENV_VAR = "PROCNANNYAUTORELOAD";
+const char* DEBOUNCE_ENV_VAR = "PROCNANNYRELOADDEBOUNCEMS";
+
+// The directory is watched so that editors which write a temporary file and rename it over the
+// config are noticed. The file itself is watched too, so that a symlinked config is followed.
+struct
+{
+    int fd;
+    int directoryWatch;
+    int fileWatch;
+    char* path;
+    char* fileName;
+    long debounceMs;
+    bool pending;
+    long long lastEventMs;
+} configWatcher = { -1, -1, -1, NULL, NULL, DEFAULT_DEBOUNCE_MS, false, 0 };
+
+bool startConfigWatcher(const char* configPath)
+{
+    const char* autoReload = getenv(AUTORELOAD_ENV_VAR);
+    if (autoReload != NULL && compareStrings(autoReload, "0"))
+    {
+        return false;
+    }
+
+    const char* debounce = getenv(DEBOUNCE_ENV_VAR);
+    if (debounce != NULL && atol(debounce) >= 0)
+    {
+        configWatcher.debounceMs = atol(debounce);
+    }
+
+    configWatcher.fd = inotify_init1(IN_NONBLOCK);
+    if (configWatcher.fd < 0)
+    {
+        LogReport report;
+        report.message = "inotify unavailable. The config file will only be re-read on SIGHUP.";
+        report.type = WARNING;
+        saveLogReport(report);
+        return false;
+    }
+
+    // dirname and basename may modify their argument
+    char* pathCopy = copyString((char*)configPath);
+    char* directory = copyString(dirname(pathCopy));
+    free(pathCopy);
+    pathCopy = copyString((char*)configPath);
+    configWatcher.fileName = copyString(basename(pathCopy));
+    free(pathCopy);
+    configWatcher.path = copyString((char*)configPath);
+
+    configWatcher.directoryWatch = inotify_add_watch(configWatcher.fd, directory,
+        RELOAD_EVENTS | IN_ONLYDIR);
+    free(directory);
+    rearmConfigWatcher();
+
+    if (configWatcher.directoryWatch < 0 && configWatcher.fileWatch < 0)
+    {
+        LogReport report;
+        report.message = "Failed to watch the config file. It will only be re-read on SIGHUP.";
+        report.type = WARNING;
+        saveLogReport(report);
+        stopConfigWatcher();
+        return false;
+    }
+    return true;
+}
+
+void stopConfigWatcher()
+{
+    if (configWatcher.fd >= 0)
+    {
+        close(configWatcher.fd);
+    }
+    configWatcher.fd = -1;
+    configWatcher.directoryWatch = -1;
+    configWatcher.fileWatch = -1;
+    configWatcher.pending = false;
+    free(configWatcher.path);
+    free(configWatcher.fileName);
+    configWatcher.path = NULL;
+    configWatcher.fileName = NULL;
+}
+
+// Renaming over the config leaves the file watch on the old inode, so this is called after every reload
+void rearmConfigWatcher()
+{
+    if (configWatcher.fd < 0)
+    {
+        return;
+    }
+    if (configWatcher.fileWatch >= 0)
+    {
+        inotify_rm_watch(configWatcher.fd, configWatcher.fileWatch);
+    }
+    configWatcher.fileWatch = inotify_add_watch(configWatcher.fd, configWatcher.path, RELOAD_EVENTS);
+}
+
+int getConfigWatcherFD()
+{
+    return configWatcher.fd;
+}
+
+//private
+void markConfigChanged()
+{
+    configWatcher.pending = true;
+    configWatcher.lastEventMs = getMonotonicMillis();
+}
+
+void handleConfigWatcherEvents()
+{
+    if (configWatcher.fd < 0)
+    {
+        return;
+    }
+
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(configWatcher.fd, buffer, sizeof(buffer))) > 0)
+    {
+        char* position = buffer;
+        while (position < buffer + length)
+        {
+            struct inotify_event* event = (struct inotify_event*)position;
+            if (!(event->mask & RELOAD_EVENTS))
+            {
+                // IN_IGNORED and the like
+            }
+            else if (event->wd == configWatcher.fileWatch)
+            {
+                markConfigChanged();
+            }
+            else if (event->wd == configWatcher.directoryWatch && event->len > 0
+                && compareStrings(event->name, configWatcher.fileName))
+            {
+                markConfigChanged();
+            }
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+// Milliseconds until a debounced reload is due, or -1 if no change is pending
+int getConfigReloadTimeout()
+{
+    if (!configWatcher.pending)
+    {
+        return -1;
+    }
+
+    long long remaining = configWatcher.lastEventMs + configWatcher.debounceMs - getMonotonicMillis();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+bool isConfigReloadDue()
+{
+    if (getConfigReloadTimeout() != 0)
+    {
+        return false;
+    }
+    configWatcher.pending = false;
+    return true;
+}
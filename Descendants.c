@@ -0,0 +1,323 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "Descendants.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "memwatch.h"
+
+// Every process that matched a children= rule in the last scan (a root), and everything found under one
+// since, by pid and start time so that a reused pid doesn't count. Each refresh reads the children of just
+// these processes (/proc/<pid>/task/<tid>/children), so a new descendant turns up within a refresh of being
+// started, without ever walking the whole process tree. A descendant stays one after its parent exits, and
+// keeps the rule it was found under.
+//
+// The members are an array, indexed by an open addressing hash on pid, which is rebuilt whenever the
+// array is compacted.
+
+#define MINIMUM_MEMBER_CAPACITY 64
+
+typedef struct
+{
+	pid_t pid;
+	unsigned long long startTime;
+	// Matched a children= rule in the scan of generation rootSeen. adoptedAt is when it was first matched, or
+	// found under a root.
+	bool isRoot;
+	unsigned int rootSeen;
+	time_t adoptedAt;
+	// Found under a root
+	bool isDescendant;
+	bool isGone;
+	// The root's rule. deadline is when its duration runs out for the root itself and children=inherit
+	// descendants, and when the descendant was found plus the duration for children=separate.
+	unsigned long int duration;
+	ResourceLimits limits;
+	time_t deadline;
+} Member;
+
+static Member* members = NULL;
+static unsigned int memberCount = 0;
+static unsigned int memberCapacity = 0;
+static unsigned int* slots = NULL;
+static unsigned int slotCapacity = 0;
+static unsigned int generation = 1;
+
+//private
+unsigned int* findMemberSlot(pid_t pid)
+{
+    unsigned int mask = slotCapacity - 1;
+    unsigned int i = ((unsigned int)pid*2654435761u) & mask;
+    while (slots[i] != 0 && members[slots[i] - 1].pid != pid)
+    {
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+//private
+// Rebuilds the hash with room for at least one more member. With compact, first drops the members that are
+// gone, or no longer roots or descendants; not while refreshDescendants is going through them.
+bool reindexMembers(bool compact)
+{
+    unsigned int i;
+    if (compact)
+    {
+        unsigned int kept = 0;
+        for (i = 0; i < memberCount; ++i)
+        {
+            if (!members[i].isGone && (members[i].isRoot || members[i].isDescendant))
+            {
+                members[kept++] = members[i];
+            }
+        }
+        memberCount = kept;
+    }
+
+    LogReport report;
+    unsigned int capacity = memberCapacity == 0 ? MINIMUM_MEMBER_CAPACITY : memberCapacity;
+    while (capacity <= memberCount*2)
+    {
+        capacity *= 2;
+    }
+    if (capacity != memberCapacity)
+    {
+        Member* newMembers = (Member*)realloc(members, capacity*sizeof(Member));
+        unsigned int* newSlots = (unsigned int*)malloc(capacity*2*sizeof(unsigned int));
+        if (!checkMallocResult(newMembers, &report) || !checkMallocResult(newSlots, &report))
+        {
+            members = newMembers == NULL ? members : newMembers;
+            free(newSlots);
+            saveLogReport(report);
+            return false;
+        }
+        free(slots);
+        members = newMembers;
+        slots = newSlots;
+        memberCapacity = capacity;
+        slotCapacity = capacity*2;
+    }
+    memset(slots, 0, slotCapacity*sizeof(unsigned int));
+    for (i = 0; i < memberCount; ++i)
+    {
+        *findMemberSlot(members[i].pid) = i + 1;
+    }
+    return true;
+}
+
+//private
+// The member for the process, added if there was none (or only one for an earlier process with its pid)
+Member* getMember(pid_t pid, unsigned long long startTime, bool* isNew)
+{
+    if (memberCount == memberCapacity && !reindexMembers(false))
+    {
+        return NULL;
+    }
+    unsigned int* slot = findMemberSlot(pid);
+    if (*slot != 0 && members[*slot - 1].startTime == startTime)
+    {
+        *isNew = false;
+        return &members[*slot - 1];
+    }
+    if (*slot != 0)
+    {
+        // Its pid was reused
+        members[*slot - 1].isGone = true;
+    }
+
+    Member* member = &members[memberCount];
+    memset(member, 0, sizeof(Member));
+    member->pid = pid;
+    member->startTime = startTime;
+    *slot = ++memberCount;
+    *isNew = true;
+    return member;
+}
+
+// For a process that matched a children= rule in this scan
+void addDescendantRoot(Process* root, const MonitorRequest* request)
+{
+    unsigned long long startTime;
+    bool isNew;
+    Member* member;
+    if (!getProcessStartTime(root, &startTime) || (member = getMember(root->pid, startTime, &isNew)) == NULL)
+    {
+        return;
+    }
+    if (!member->isRoot)
+    {
+        member->isRoot = true;
+        member->adoptedAt = time(NULL);
+    }
+    // Follows the rule as it changes with the config, like the root's own monitoring does
+    member->duration = request->monitorDuration;
+    member->limits = request->limits;
+    member->deadline = member->adoptedAt + (time_t)request->monitorDuration;
+    member->rootSeen = generation;
+}
+
+//private
+bool isMemberAlive(const Member* member)
+{
+    Process process;
+    initProcessQuery(&process, member->pid, NULL);
+    unsigned long long startTime;
+    bool isAlive = getProcessStartTime(&process, &startTime) && startTime == member->startTime;
+    clearProcessQuery(&process);
+    return isAlive;
+}
+
+typedef struct
+{
+	unsigned int parentIndex;
+	time_t now;
+} ChildContext;
+
+//private
+void addChild(pid_t pid, void* context)
+{
+    unsigned int parentIndex = ((ChildContext*)context)->parentIndex;
+    time_t now = ((ChildContext*)context)->now;
+    Process process;
+    initProcessQuery(&process, pid, NULL);
+    unsigned long long startTime;
+    bool isRead = getProcessStartTime(&process, &startTime);
+    clearProcessQuery(&process);
+    bool isNew;
+    Member* child;
+    if (!isRead || (child = getMember(pid, startTime, &isNew)) == NULL || !isNew)
+    {
+        return;
+    }
+    // getMember may have moved the array
+    const Member* parent = &members[parentIndex];
+    child->isDescendant = true;
+    child->adoptedAt = now;
+    child->duration = parent->duration;
+    child->limits = parent->limits;
+    child->deadline = parent->limits.children == CHILDREN_INHERIT ? parent->deadline : now + (time_t)parent->duration;
+}
+
+//private
+Process* constructMemberProcess(const Member* member)
+{
+    char comm[MAX_COMM_LENGTH + 2];
+    int length = readProcFile(member->pid, "comm", comm, sizeof(comm));
+    if (length <= 0)
+    {
+        return NULL;
+    }
+    if (comm[length - 1] == '\n')
+    {
+        comm[length - 1] = '\0';
+    }
+    return processConstructor(member->pid, comm);
+}
+
+// After a scan: finds the new descendants of the roots added in it, and forgets what has exited. Returns every
+// descendant there is, with the rule it should be monitored under, or NULL if there are none.
+Descendant* refreshDescendants(int* count)
+{
+    *count = 0;
+    time_t now = time(NULL);
+    unsigned int i;
+    // Children found along the way are appended, and walked in turn
+    for (i = 0; i < memberCount; ++i)
+    {
+        if (members[i].isRoot && members[i].rootSeen != generation)
+        {
+            // Its rule no longer matches it (or has no children= any more)
+            members[i].isRoot = false;
+        }
+        if (!members[i].isRoot && !members[i].isDescendant)
+        {
+            continue;
+        }
+        if (!isMemberAlive(&members[i]))
+        {
+            members[i].isGone = true;
+            continue;
+        }
+        ChildContext context;
+        context.parentIndex = i;
+        context.now = now;
+        forEachChild(members[i].pid, addChild, &context);
+    }
+    ++generation;
+    if (memberCount > 0)
+    {
+        reindexMembers(true);
+    }
+
+    int descendantCount = 0;
+    for (i = 0; i < memberCount; ++i)
+    {
+        descendantCount += members[i].isDescendant && !members[i].isRoot ? 1 : 0;
+    }
+    if (descendantCount == 0)
+    {
+        return NULL;
+    }
+    Descendant* descendants = (Descendant*)malloc(descendantCount*sizeof(Descendant));
+    LogReport report;
+    if (!checkMallocResult(descendants, &report))
+    {
+        saveLogReport(report);
+        return NULL;
+    }
+    for (i = 0; i < memberCount; ++i)
+    {
+        const Member* member = &members[i];
+        Process* process;
+        if (!member->isDescendant || member->isRoot || (process = constructMemberProcess(member)) == NULL)
+        {
+            continue;
+        }
+        Descendant* descendant = &descendants[(*count)++];
+        memset(descendant, 0, sizeof(Descendant));
+        descendant->process = process;
+        descendant->request.limits = member->limits;
+        // Counted from when it was found, so that it stays the same from one refresh to the next
+        descendant->request.monitorDuration = member->deadline > member->adoptedAt
+            ? (unsigned long int)(member->deadline - member->adoptedAt) : 0;
+    }
+    return descendants;
+}
+
+void destroyDescendantArray(Descendant* array, int count)
+{
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        processDestructor(array[i].process);
+    }
+    free(array);
+}
+
+void stopDescendants()
+{
+    free(members);
+    free(slots);
+    members = NULL;
+    slots = NULL;
+    memberCount = 0;
+    memberCapacity = 0;
+    slotCapacity = 0;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef __DESCENDANTS_H__
+#define __DESCENDANTS_H__
+
+#include "Process.h"
+#include "MonitorRequest.h"
+#include <stdbool.h>
+
+typedef struct
+{
+	Process* process;
+	// Its root's rule, with the duration from when it was found until the root's deadline for children=inherit.
+	// Only the duration and limits are set.
+	MonitorRequest request;
+} Descendant;
+
+// Brings the descendants of the processes that match children= rules under those rules
+void addDescendantRoot(Process* root, const MonitorRequest* request);
+Descendant* refreshDescendants(int* count);
+void destroyDescendantArray(Descendant* array, int count);
+void stopDescendants();
+#endif
\ No newline at end of file
@@ -18,18 +18,50 @@ limitations under the License.
 #include "Utils.h"
 #include <time.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
 #include "memwatch.h"
 
+#define DEFAULT_SYNC_MS 50
+#define DEFAULT_SYNC_RECORDS 64
+
 const char* LOGFILE_ENV_VAR = "PROCNANNYLOGS";
+const char* LOGSYNC_ENV_VAR = "PROCNANNYLOGSYNC";
+const char* LOGSYNC_MS_ENV_VAR = "PROCNANNYLOGSYNCMS";
+const char* LOGSYNC_RECORDS_ENV_VAR = "PROCNANNYLOGSYNCRECORDS";
 const char* LOGFILE_FLASH = "\n===================PROCNANNY v2.0, Udey Rishi===================";
 
+typedef enum { LOG_SYNC_NONE, LOG_SYNC_GROUP, LOG_SYNC_ALWAYS } LogSyncMode;
+
+// Group commit state of the log file. Records are written as they come, and made durable in batches
+// by a single fdatasync once either maxRecords are pending or the oldest pending one is maxDelayMs old.
+struct
+{
+    bool initialized;
+    LogSyncMode mode;
+    long maxDelayMs;
+    int maxRecords;
+    int fd;
+    int pendingRecords;
+    long long oldestPendingMs;
+    unsigned long writtenRecords;
+    unsigned long committedRecords;
+    unsigned long commits;
+    unsigned long failedCommits;
+    long long maxAckLatencyMs;
+    long long totalSyncMs;
+} logSync = { false, LOG_SYNC_NONE, DEFAULT_SYNC_MS, DEFAULT_SYNC_RECORDS, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+
 // private
 char* getTime()
 {
     char* output;
     time_t rawtime;
     time (&rawtime);
-    char* t = ctime(&rawtime);
+    // Not ctime: memwatch uses its buffer too, the first time stringJoin allocates
+    char t[32];
+    ctime_r(&rawtime, t);
     t[strlen(t) - 1] = '\0';
     output = stringJoin("[", t);
     char* output2 = stringJoin(output, "] ");
@@ -73,10 +105,98 @@ char* getFormattedReport(LogReport report)
     return output2;
 }
 
+// private
+void initLogSyncSettings()
+{
+    if (logSync.initialized)
+    {
+        return;
+    }
+    logSync.initialized = true;
+    logSync.mode = LOG_SYNC_NONE;
+    logSync.maxDelayMs = DEFAULT_SYNC_MS;
+    logSync.maxRecords = DEFAULT_SYNC_RECORDS;
+
+    const char* mode = getenv(LOGSYNC_ENV_VAR);
+    if (mode != NULL)
+    {
+        if (compareStrings(mode, "group"))
+        {
+            logSync.mode = LOG_SYNC_GROUP;
+        }
+        else if (compareStrings(mode, "always"))
+        {
+            logSync.mode = LOG_SYNC_ALWAYS;
+        }
+        else if (!compareStrings(mode, "none"))
+        {
+            // Already initialized, so this goes through the usual path
+            LogReport report;
+            report.message = "PROCNANNYLOGSYNC is not one of none, always or group. The log will not be synced.";
+            report.type = WARNING;
+            saveLogReport(report);
+        }
+    }
+
+    const char* delay = getenv(LOGSYNC_MS_ENV_VAR);
+    if (delay != NULL && atol(delay) >= 0)
+    {
+        logSync.maxDelayMs = atol(delay);
+    }
+
+    const char* records = getenv(LOGSYNC_RECORDS_ENV_VAR);
+    if (records != NULL && atoi(records) > 0)
+    {
+        logSync.maxRecords = atoi(records);
+    }
+}
+
+// private
+// fdatasync() everything written so far. Every pending record is acknowledged by this one call. A failed one
+// acknowledges none of them, and isn't retried: the kernel reports a writeback error only once.
+void commitLog()
+{
+    if (logSync.fd < 0 || logSync.pendingRecords == 0)
+    {
+        return;
+    }
+
+    long long started = getMonotonicMillis();
+    int result;
+    while ((result = fdatasync(logSync.fd)) < 0 && errno == EINTR);
+    long long finished = getMonotonicMillis();
+    logSync.totalSyncMs += finished - started;
+    if (result < 0)
+    {
+        // Not to the log file itself, whose commit is what failed
+        LogReport report;
+        report.message = "Failed to sync the log file. Records written since the last sync may be lost.";
+        report.type = ERROR;
+        printLogReport(report);
+        logSync.failedCommits++;
+        logSync.pendingRecords = 0;
+        return;
+    }
+
+    long long latency = finished - logSync.oldestPendingMs;
+    if (latency > logSync.maxAckLatencyMs)
+    {
+        logSync.maxAckLatencyMs = latency;
+    }
+    logSync.committedRecords += logSync.pendingRecords;
+    logSync.commits++;
+    logSync.pendingRecords = 0;
+}
+
 bool appendToFile(const char* path, const char* string)
 {
-    FILE *f = fopen(path, "a+");
-    if (f == NULL)
+    initLogSyncSettings();
+    if (logSync.fd < 0)
+    {
+        logSync.fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    }
+
+    if (logSync.fd < 0)
     {
         LogReport report;
         report.message = "Failed to open log file.";
@@ -85,11 +205,77 @@ bool appendToFile(const char* path, const char* string)
         return false;
     }
 
-    fprintf(f, "%s\n", string);
-    fclose(f);
+    // One write per record, so that a record is never split between two commits. Only a short write (a full
+    // disk, or a signal) takes more than one.
+    char* line = stringJoin(string, "\n");
+    size_t length = strlen(line);
+    size_t written = 0;
+    while (written < length)
+    {
+        ssize_t result = write(logSync.fd, line + written, length - written);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            break;
+        }
+        written += result;
+    }
+    free(line);
+    if (written < length)
+    {
+        LogReport report;
+        report.message = "Failed to write to log file.";
+        report.type = ERROR;
+        printLogReport(report);
+        return false;
+    }
+    logSync.writtenRecords++;
+
+    if (logSync.mode == LOG_SYNC_NONE)
+    {
+        return true;
+    }
+
+    if (logSync.pendingRecords == 0)
+    {
+        logSync.oldestPendingMs = getMonotonicMillis();
+    }
+    logSync.pendingRecords++;
+
+    if (logSync.mode == LOG_SYNC_ALWAYS || logSync.pendingRecords >= logSync.maxRecords)
+    {
+        commitLog();
+    }
     return true;
 }
 
+int getLogCommitTimeout()
+{
+    if (logSync.mode != LOG_SYNC_GROUP || logSync.pendingRecords == 0)
+    {
+        return -1;
+    }
+
+    long long remaining = logSync.oldestPendingMs + logSync.maxDelayMs - getMonotonicMillis();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+void logCommitIfDue()
+{
+    if (getLogCommitTimeout() == 0)
+    {
+        commitLog();
+    }
+}
+
+void logCommitNow()
+{
+    commitLog();
+}
+
 void saveLogReport(LogReport report)
 {
     char* output = getFormattedReport(report);
@@ -128,6 +314,31 @@ void logFinalReport(int killCount)
     saveLogReport(report);
     printLogReport(report);
     free(message2);
+    logCommitNow();
+    logDurabilityReport();
+}
+
+void logDurabilityReport()
+{
+    if (logSync.mode == LOG_SYNC_NONE)
+    {
+        return;
+    }
+
+    char buffer[320];
+    snprintf(buffer, sizeof(buffer), "Log durability: %lu record(s) written, %lu committed in %lu fdatasync(s) "
+        "(%.1f records/commit, %lld ms max acknowledgement latency, %lld ms total in fdatasync), %lu fdatasync(s) "
+        "failed.",
+        logSync.writtenRecords, logSync.committedRecords, logSync.commits,
+        logSync.commits == 0 ? 0.0 : (double)logSync.committedRecords/logSync.commits,
+        logSync.maxAckLatencyMs, logSync.totalSyncMs, logSync.failedCommits);
+
+    LogReport report;
+    report.type = logSync.failedCommits > 0 ? WARNING : INFO;
+    report.message = buffer;
+    saveLogReport(report);
+    printLogReport(report);
+    logCommitNow();
 }
 
 void logProcessMonitoringInit(char* processName, pid_t pid)
@@ -167,6 +378,103 @@ void logProcessKill(pid_t pid, const char* name, unsigned long int duration)
     free(report.message);
 }
 
+void logLimitKill(pid_t pid, const char* name, const char* reason)
+{
+    LogReport report;
+    char* message = stringNumberJoin("PID ", pid);
+    char* message2 = stringJoin(message, " (");
+    free(message);
+    message = stringJoin(message2, name);
+    free(message2);
+    message2 = stringJoin(message, ") killed for ");
+    free(message);
+    message = stringJoin(message2, reason);
+    free(message2);
+    message2 = stringJoin(message, ".");
+    free(message);
+    report.message = message2;
+    report.type = ACTION;
+    saveLogReport(report);
+    free(report.message);
+}
+
+//private
+// "PID <pid> (<name>)" followed by text
+void logProcessAction(pid_t pid, const char* name, const char* text)
+{
+    LogReport report;
+    char* message = stringNumberJoin("PID ", pid);
+    char* message2 = stringJoin(message, " (");
+    free(message);
+    message = stringJoin(message2, name);
+    free(message2);
+    message2 = stringJoin(message, ")");
+    free(message);
+    message = stringJoin(message2, text);
+    free(message2);
+    report.message = message;
+    report.type = ACTION;
+    saveLogReport(report);
+    free(report.message);
+}
+
+// The first stage of killing a process whose rule has a signal=. reason says why, as in "after exceeding
+// 10 seconds".
+void logSignalSent(pid_t pid, const char* name, const char* signalName, const char* reason, unsigned int graceSeconds)
+{
+    char text[256];
+    snprintf(text, sizeof(text), " sent %s %s. SIGKILL follows in %u seconds if it is still running.", signalName,
+        reason, graceSeconds);
+    logProcessAction(pid, name, text);
+}
+
+void logSignalExit(pid_t pid, const char* name, const char* signalName, long long millis)
+{
+    char text[128];
+    snprintf(text, sizeof(text), " exited %lld.%03lld seconds after %s.", millis/1000, millis%1000, signalName);
+    logProcessAction(pid, name, text);
+}
+
+void logGraceKill(pid_t pid, const char* name, const char* signalName, unsigned int graceSeconds)
+{
+    char text[128];
+    snprintf(text, sizeof(text), " still running %u seconds after %s, killed with SIGKILL.", graceSeconds, signalName);
+    logProcessAction(pid, name, text);
+}
+
+// The reclaim step, with how much the process's resident size went down by
+void logReclaim(pid_t pid, const char* name, unsigned long freedKiB)
+{
+    char text[128];
+    snprintf(text, sizeof(text), " over its memory limit, paged out %lu KiB.", freedKiB);
+    logProcessAction(pid, name, text);
+}
+
+void logReclaimAvoided(pid_t pid, const char* name)
+{
+    logProcessAction(pid, name, " back under its memory limit after reclaim, not killed.");
+}
+
+void logReclaimReport(unsigned long long freedKiB, unsigned int attempts, unsigned int avoided)
+{
+    char buffer[160];
+    snprintf(buffer, sizeof(buffer), "Memory reclaim: %llu KiB paged out over %u attempt(s), %u kill(s) avoided.",
+        freedKiB, attempts, avoided);
+    LogReport report;
+    report.type = INFO;
+    report.message = buffer;
+    saveLogReport(report);
+    printLogReport(report);
+}
+
+// The soft= step. how says what was done, as in "to 10 percent of a CPU".
+void logThrottle(pid_t pid, const char* name, const char* how, unsigned int softSeconds)
+{
+    char text[160];
+    snprintf(text, sizeof(text), " throttled %s after %u seconds.", how, softSeconds);
+    logProcessAction(pid, name, text);
+}
+
 void logSelfDying(pid_t pid, const char* name, unsigned long int duration)
 {
     LogReport report;
@@ -201,6 +509,31 @@ void logSighupCatch(char* configFileName)
     free(sighupReport.message);
 }
 
+void logConfigFileChange(char* configFileName)
+{
+    LogReport report;
+    report.type = INFO;
+    char* message = stringJoin("Configuration file '", configFileName);
+    char* message2 = stringJoin(message, "' changed on disk. Re-reading it.");
+    free(message);
+    report.message = message2;
+    saveLogReport(report);
+    printLogReport(report);
+    free(report.message);
+}
+
+void logConfigDiff(int added, int removed, int changed, int retargeted, long long compileMillis)
+{
+    char buffer[192];
+    snprintf(buffer, sizeof(buffer), "Config applied: %d rule(s) added, %d removed, %d changed, %d monitored process(es) retargeted. "
+        "Compiled in %lld ms.", added, removed, changed, retargeted, compileMillis);
+
+    LogReport report;
+    report.type = INFO;
+    report.message = buffer;
+    saveLogReport(report);
+}
+
 void logParentInit()
 {
     const char* logFile = getenv(LOGFILE_ENV_VAR);
@@ -33,5 +33,19 @@ void logParentInit();
 void logProcessMonitoringInit(char* processName, pid_t pid);
 void logProcessKill(pid_t pid, const char* name, unsigned long int duration);
 void logSelfDying(pid_t pid, const char* name, unsigned long int duration);
+void logLimitKill(pid_t pid, const char* name, const char* reason);
+void logSignalSent(pid_t pid, const char* name, const char* signalName, const char* reason, unsigned int graceSeconds);
+void logSignalExit(pid_t pid, const char* name, const char* signalName, long long millis);
+void logGraceKill(pid_t pid, const char* name, const char* signalName, unsigned int graceSeconds);
+void logReclaim(pid_t pid, const char* name, unsigned long freedKiB);
+void logReclaimAvoided(pid_t pid, const char* name);
+void logReclaimReport(unsigned long long freedKiB, unsigned int attempts, unsigned int avoided);
+void logThrottle(pid_t pid, const char* name, const char* how, unsigned int softSeconds);
 void logSighupCatch(char* configFileName);
+void logConfigFileChange(char* configFileName);
+void logConfigDiff(int added, int removed, int changed, int retargeted, long long compileMillis);
+void logDurabilityReport();
+int getLogCommitTimeout();
+void logCommitIfDue();
+void logCommitNow();
 #endif
\ No newline at end of file
@@ -18,99 +18,809 @@ limitations under the License.
 #include "Logging.h"
 #include "Utils.h"
 #include "ProgramIO.h"
+#include "RuleSet.h"
+#include "PatternCompiler.h"
+#include <string.h>
+#include <pwd.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "memwatch.h"
 
-MonitorRequest* constructMonitorRequest(char* requestString)
+const char* GLOB_PREFIX = "glob:";
+const char* REGEX_PREFIX = "re:";
+const char* EXE_PREFIX = "exe:";
+const char* CGROUP_PREFIX = "cgroup:";
+const char* UID_OPTION = "uid=";
+const char* USER_OPTION = "user=";
+const char* ARGV_OPTION = "argv=";
+const char* PARENT_OPTION = "parent=";
+const char* RSS_OPTION = "rss>";
+const char* CPU_OPTION = "cpu>";
+const char* CPU_TIME_OPTION = "cputime>";
+const char* IDLE_OPTION = "idle>";
+const char* SIGNAL_OPTION = "signal=";
+const char* GRACE_OPTION = "grace=";
+const char* KILL_OPTION = "kill=";
+const char* KILL_TREE = "tree";
+const char* KILL_PROCESS = "process";
+const char* CHILDREN_OPTION = "children=";
+const char* CHILDREN_INHERIT_VALUE = "inherit";
+const char* CHILDREN_SEPARATE_VALUE = "separate";
+const char* SOFT_OPTION = "soft=";
+const char* THROTTLE_OPTION = "throttle=";
+const char* RECLAIM_OPTION = "reclaim";
+const char* PRIORITY_OPTION = "priority=";
+const char* FOR_KEYWORD = "for";
+
+typedef struct
+{
+    const char* name;
+    int signal;
+} SignalName;
+
+// The signals a rule can ask for, by the names kill -l gives them
+const SignalName SIGNAL_NAMES[] = {
+    { "SIGTERM", SIGTERM }, { "SIGINT", SIGINT }, { "SIGHUP", SIGHUP }, { "SIGQUIT", SIGQUIT },
+    { "SIGUSR1", SIGUSR1 }, { "SIGUSR2", SIGUSR2 }, { "SIGKILL", SIGKILL }
+};
+
+//private
+bool isBlank(char c)
 {
-    MonitorRequest* this = (MonitorRequest*)malloc(sizeof(MonitorRequest));
-    LogReport report;
-    if (!checkMallocResult(this, &report))
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+//private
+bool hasPrefix(const char* name, int nameLength, const char* prefix)
+{
+    int length = strlen(prefix);
+    return nameLength > length && memcmp(name, prefix, length) == 0;
+}
+
+//private
+bool parseUid(const char* text, int length, uid_t* uid)
+{
+    if (length == 0 || length > 10)
     {
-        saveLogReport(report);
-        return NULL;
+        return false;
     }
-
-    this->processName = getNextStrTokString(requestString);
-    char* monitorDuration = getNextStrTokString(NULL);
-    this->monitorDuration = strtoul(monitorDuration, NULL, 10);
-    free(monitorDuration);
-    return this;
+    unsigned long int value = 0;
+    int i;
+    for (i = 0; i < length; ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        value = value*10 + (unsigned long int)(text[i] - '0');
+    }
+    *uid = (uid_t)value;
+    return (unsigned long int)*uid == value;
 }
 
-void destroyMonitorRequest(MonitorRequest* this)
+//private
+// getpwnam_r, since this runs on the config compiler thread
+bool lookUpUser(const char* text, int length, uid_t* uid)
 {
-    free(this->processName);
-    free(this);
+    char name[256];
+    char buffer[4096];
+    if (length >= (int)sizeof(name))
+    {
+        return false;
+    }
+    memcpy(name, text, length);
+    name[length] = '\0';
+
+    struct passwd entry;
+    struct passwd* result = NULL;
+    if (getpwnam_r(name, &entry, buffer, sizeof(buffer), &result) != 0 || result == NULL)
+    {
+        return false;
+    }
+    *uid = result->pw_uid;
+    return true;
 }
 
-void destroyMonitorRequestArray(MonitorRequest** requestArray, int size)
+//private
+// A size in bytes with an optional K, M, G or T suffix (powers of 1024), as KiB rounded up
+bool parseSize(const char* text, int length, unsigned long long* kib)
 {
-    if (requestArray == NULL)
+    unsigned long long value = 0;
+    int i;
+    for (i = 0; i < length && text[i] >= '0' && text[i] <= '9'; ++i)
+    {
+        if (value > ULLONG_MAX/10 - 9)
+        {
+            return false;
+        }
+        value = value*10 + (unsigned long long)(text[i] - '0');
+    }
+    if (i == 0 || i < length - 1)
+    {
+        return false;
+    }
+
+    int shift = 0;
+    if (i == length - 1)
     {
-        return;
+        const char* suffixes = "KMGT";
+        char suffix = text[i] >= 'a' && text[i] <= 'z' ? (char)(text[i] - 'a' + 'A') : text[i];
+        const char* found = suffix == '\0' ? NULL : strchr(suffixes, suffix);
+        if (found == NULL)
+        {
+            return false;
+        }
+        shift = 10*(int)(found - suffixes + 1);
+    }
+    if (shift == 0)
+    {
+        *kib = (value + 1023)/1024;
+        return true;
     }
+    *kib = value << (shift - 10);
+    return (*kib >> (shift - 10)) == value;
+}
 
+//private
+// A whole number, with an optional suffix that is one of the characters in suffixes
+bool parseNumber(const char* text, int length, const char* suffixes, unsigned long* value)
+{
+    if (length > 0 && text[length - 1] != '\0' && strchr(suffixes, text[length - 1]) != NULL)
+    {
+        --length;
+    }
+    if (length == 0 || length > 9)
+    {
+        return false;
+    }
+    *value = 0;
     int i;
-    for (i = 0; i < size; ++i)
+    for (i = 0; i < length; ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        *value = *value*10 + (unsigned long)(text[i] - '0');
+    }
+    return true;
+}
+
+//private
+// Seconds, or with an s, m or h suffix
+bool parseSeconds(const char* text, int length, unsigned int* seconds)
+{
+    unsigned long value;
+    if (!parseNumber(text, length, "smh", &value))
+    {
+        return false;
+    }
+    unsigned long unit = 1;
+    switch (text[length - 1])
+    {
+        case 'm':
+            unit = 60;
+            break;
+        case 'h':
+            unit = 3600;
+            break;
+        default:
+            break;
+    }
+    if (value > UINT_MAX/unit)
+    {
+        return false;
+    }
+    *seconds = (unsigned int)(value*unit);
+    return true;
+}
+
+//private
+// An "rss>", "cpu>", "cputime>" or "idle>" option. The "for" that may follow the first two is parsed by
+// parseRequestLine, into *seconds.
+bool parseLimitOption(const char* option, int length, ResourceLimits* limits, unsigned int** seconds)
+{
+    if (hasPrefix(option, length, RSS_OPTION) && !(limits->active & LIMIT_RSS))
+    {
+        int prefixLength = strlen(RSS_OPTION);
+        if (!parseSize(option + prefixLength, length - prefixLength, &limits->rss))
+        {
+            return false;
+        }
+        limits->active |= LIMIT_RSS;
+        *seconds = &limits->rssSeconds;
+        return true;
+    }
+    if (hasPrefix(option, length, CPU_OPTION) && !(limits->active & LIMIT_CPU))
+    {
+        int prefixLength = strlen(CPU_OPTION);
+        unsigned long percent;
+        if (!parseNumber(option + prefixLength, length - prefixLength, "%", &percent))
+        {
+            return false;
+        }
+        limits->cpu = (unsigned int)percent;
+        limits->active |= LIMIT_CPU;
+        *seconds = &limits->cpuSeconds;
+        return true;
+    }
+    if (hasPrefix(option, length, CPU_TIME_OPTION) && !(limits->active & LIMIT_CPU_TIME))
+    {
+        int prefixLength = strlen(CPU_TIME_OPTION);
+        if (!parseSeconds(option + prefixLength, length - prefixLength, &limits->cpuTime))
+        {
+            return false;
+        }
+        limits->active |= LIMIT_CPU_TIME;
+        return true;
+    }
+    if (hasPrefix(option, length, IDLE_OPTION) && !(limits->active & LIMIT_IDLE))
+    {
+        int prefixLength = strlen(IDLE_OPTION);
+        if (!parseSeconds(option + prefixLength, length - prefixLength, &limits->idleSeconds)
+            || limits->idleSeconds == 0)
+        {
+            return false;
+        }
+        limits->active |= LIMIT_IDLE;
+        return true;
+    }
+    return false;
+}
+
+//private
+// "signal=TERM" (or SIGTERM), "grace=TIME", or "kill=tree" (or "kill=process", the default). A signal= without a
+// grace= gets DEFAULT_GRACE_SECONDS, and a grace= without a signal= DEFAULT_KILL_SIGNAL; parseRequestLine
+// fills those in.
+bool parseKillOption(const char* option, int length, ResourceLimits* limits, bool* hasGrace)
+{
+    if (hasPrefix(option, length, KILL_OPTION))
+    {
+        const char* value = option + strlen(KILL_OPTION);
+        int valueLength = length - strlen(KILL_OPTION);
+        limits->killTree = valueLength == (int)strlen(KILL_TREE) && memcmp(value, KILL_TREE, valueLength) == 0;
+        return limits->killTree
+            || (valueLength == (int)strlen(KILL_PROCESS) && memcmp(value, KILL_PROCESS, valueLength) == 0);
+    }
+    if (hasPrefix(option, length, GRACE_OPTION) && !*hasGrace)
+    {
+        int prefixLength = strlen(GRACE_OPTION);
+        *hasGrace = true;
+        return parseSeconds(option + prefixLength, length - prefixLength, &limits->graceSeconds);
+    }
+    if (!hasPrefix(option, length, SIGNAL_OPTION) || limits->signal != 0)
+    {
+        return false;
+    }
+
+    const char* value = option + strlen(SIGNAL_OPTION);
+    int valueLength = length - strlen(SIGNAL_OPTION);
+    unsigned int i;
+    for (i = 0; i < sizeof(SIGNAL_NAMES)/sizeof(SignalName); ++i)
+    {
+        const char* name = SIGNAL_NAMES[i].name;
+        int nameLength = strlen(name);
+        if ((valueLength == nameLength && memcmp(value, name, nameLength) == 0)
+            || (valueLength == nameLength - 3 && memcmp(value, name + 3, valueLength) == 0))
+        {
+            limits->signal = SIGNAL_NAMES[i].signal;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* getSignalName(int signal)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(SIGNAL_NAMES)/sizeof(SignalName); ++i)
+    {
+        if (SIGNAL_NAMES[i].signal == signal)
+        {
+            return SIGNAL_NAMES[i].name;
+        }
+    }
+    return "a signal";
+}
+
+bool hasSameLimits(const ResourceLimits* first, const ResourceLimits* second)
+{
+    return first->active == second->active && first->rss == second->rss && first->cpu == second->cpu
+        && first->rssSeconds == second->rssSeconds && first->cpuSeconds == second->cpuSeconds
+        && first->cpuTime == second->cpuTime && first->idleSeconds == second->idleSeconds
+        && first->signal == second->signal && first->graceSeconds == second->graceSeconds
+        && first->killTree == second->killTree && first->children == second->children
+        && first->softSeconds == second->softSeconds && first->throttleCpu == second->throttleCpu
+        && first->reclaim == second->reclaim && first->priority == second->priority;
+}
+
+//private
+// "soft=TIME" or "throttle=N%". parseRequestLine checks that a soft= comes before the duration is up, and
+// fills in DEFAULT_THROTTLE_CPU.
+bool parseThrottleOption(const char* option, int length, ResourceLimits* limits, bool* hasSoft)
+{
+    if (hasPrefix(option, length, SOFT_OPTION) && !*hasSoft)
+    {
+        int prefixLength = strlen(SOFT_OPTION);
+        *hasSoft = true;
+        return parseSeconds(option + prefixLength, length - prefixLength, &limits->softSeconds);
+    }
+    if (!hasPrefix(option, length, THROTTLE_OPTION) || limits->throttleCpu != 0)
+    {
+        return false;
+    }
+    int prefixLength = strlen(THROTTLE_OPTION);
+    unsigned long percent;
+    if (!parseNumber(option + prefixLength, length - prefixLength, "%", &percent) || percent == 0)
+    {
+        return false;
+    }
+    limits->throttleCpu = (unsigned int)percent;
+    return true;
+}
+
+//private
+// "children=inherit" or "children=separate"
+bool parseChildrenOption(const char* option, int length, ResourceLimits* limits)
+{
+    if (!hasPrefix(option, length, CHILDREN_OPTION) || limits->children != CHILDREN_NONE)
+    {
+        return false;
+    }
+    const char* value = option + strlen(CHILDREN_OPTION);
+    int valueLength = length - strlen(CHILDREN_OPTION);
+    if (valueLength == (int)strlen(CHILDREN_INHERIT_VALUE) && memcmp(value, CHILDREN_INHERIT_VALUE, valueLength) == 0)
+    {
+        limits->children = CHILDREN_INHERIT;
+    }
+    else if (valueLength == (int)strlen(CHILDREN_SEPARATE_VALUE)
+        && memcmp(value, CHILDREN_SEPARATE_VALUE, valueLength) == 0)
+    {
+        limits->children = CHILDREN_SEPARATE;
+    }
+    return limits->children != CHILDREN_NONE;
+}
+
+//private
+// "priority=N", with N at least 1
+bool parsePriorityOption(const char* option, int length, ResourceLimits* limits)
+{
+    if (!hasPrefix(option, length, PRIORITY_OPTION) || limits->priority != 0)
+    {
+        return false;
+    }
+    int prefixLength = strlen(PRIORITY_OPTION);
+    unsigned long priority;
+    if (!parseNumber(option + prefixLength, length - prefixLength, "", &priority) || priority == 0)
     {
-        destroyMonitorRequest(requestArray[i]);
+        return false;
     }
+    limits->priority = (unsigned int)priority;
+    return true;
+}
 
-    free(requestArray);
+//private
+// One "key=value" option after the duration. Options can come in any order; argv= can be repeated.
+bool parseRequestOption(const char* option, int length, RequestPredicates* predicates)
+{
+    if (hasPrefix(option, length, UID_OPTION) || hasPrefix(option, length, USER_OPTION))
+    {
+        bool isUid = hasPrefix(option, length, UID_OPTION);
+        int prefixLength = strlen(isUid ? UID_OPTION : USER_OPTION);
+        const char* value = option + prefixLength;
+        int valueLength = length - prefixLength;
+        if ((predicates->predicates & PREDICATE_UID) || (isUid && !parseUid(value, valueLength, &predicates->uid)))
+        {
+            return false;
+        }
+        if (!isUid && !lookUpUser(value, valueLength, &predicates->uid))
+        {
+            // Whether a user exists can change between the two passes over the config, so this must not
+            // decide whether the line counts
+            predicates->uid = (uid_t)-1;
+            predicates->isUnresolved = true;
+        }
+        predicates->predicates |= PREDICATE_UID;
+        return true;
+    }
+    if (hasPrefix(option, length, ARGV_OPTION))
+    {
+        if (predicates->argvCount == MAX_ARGV_PREDICATES)
+        {
+            return false;
+        }
+        predicates->argv[predicates->argvCount] = option + strlen(ARGV_OPTION);
+        predicates->argvLength[predicates->argvCount] = length - strlen(ARGV_OPTION);
+        predicates->argvCount++;
+        predicates->predicates |= PREDICATE_ARGV;
+        return true;
+    }
+    if (hasPrefix(option, length, PARENT_OPTION) && !(predicates->predicates & PREDICATE_PARENT))
+    {
+        predicates->parentName = option + strlen(PARENT_OPTION);
+        predicates->parentNameLength = length - strlen(PARENT_OPTION);
+        predicates->predicates |= PREDICATE_PARENT;
+        return true;
+    }
+    return false;
 }
 
-int getProcessesToMonitor(int argc, char** argv, MonitorRequest*** monitorRequests)
+//private
+// Parses one "name [duration] [option...]" line in place. line..end excludes the newline and is not NUL
+// terminated. A line with an option that isn't understood, or with neither a duration nor a limit, is ignored
+// as a whole.
+bool parseRequestLine(const char* line, const char* end, const char** name, int* nameLength, unsigned long int* duration,
+    RequestPredicates* predicates, ResourceLimits* limits)
 {
-    LogReport report;
-    report.message = (char*)NULL;
+    while (line < end && isBlank(*line))
+    {
+        ++line;
+    }
+    *name = line;
+    while (line < end && !isBlank(*line))
+    {
+        ++line;
+    }
+    *nameLength = (int)(line - *name);
 
-    if (argc < 2)
+    while (line < end && isBlank(*line))
+    {
+        ++line;
+    }
+    if (*nameLength == 0)
     {
-        report.message = "Config file path needed as argument.";
-        report.type = ERROR;
-        saveLogReport(report);
-        printLogReport(report);
-        return -1;
+        return false;
     }
 
-    char* configPath = argv[1];
-    int configLines = 0;
-    char** config = readFile(configPath, &configLines, &report);
+    memset(limits, 0, sizeof(ResourceLimits));
+    *duration = 0;
+    if (line < end && *line >= '0' && *line <= '9')
+    {
+        while (line < end && *line >= '0' && *line <= '9')
+        {
+            // Kept within an int, so that adding it to a start time can't overflow either
+            unsigned long int digit = (unsigned long int)(*line - '0');
+            if (*duration > (INT_MAX - digit)/10)
+            {
+                return false;
+            }
+            *duration = *duration*10 + digit;
+            ++line;
+        }
+        limits->active |= LIMIT_WALL_TIME;
+    }
 
-    if (report.message != NULL)
+    memset(predicates, 0, sizeof(RequestPredicates));
+    unsigned int* seconds = NULL;
+    bool hasGrace = false;
+    bool hasSoft = false;
+    while (true)
     {
-        if (configLines > 0)
+        while (line < end && isBlank(*line))
+        {
+            ++line;
+        }
+        const char* option = line;
+        while (line < end && !isBlank(*line))
+        {
+            ++line;
+        }
+        int length = (int)(line - option);
+        if (length == 0)
+        {
+            if (limits->signal == SIGKILL)
+            {
+                limits->signal = 0;
+            }
+            else if (limits->signal == 0 && hasGrace)
+            {
+                limits->signal = DEFAULT_KILL_SIGNAL;
+            }
+            else if (limits->signal != 0 && !hasGrace)
+            {
+                limits->graceSeconds = DEFAULT_GRACE_SECONDS;
+            }
+            if (limits->signal == 0)
+            {
+                limits->graceSeconds = 0;
+            }
+            if (hasSoft != (limits->throttleCpu != 0))
+            {
+                if (!hasSoft)
+                {
+                    // A throttle= alone
+                    return false;
+                }
+                limits->throttleCpu = DEFAULT_THROTTLE_CPU;
+            }
+            if ((hasSoft && (!(limits->active & LIMIT_WALL_TIME) || limits->softSeconds >= *duration))
+                || (limits->reclaim && !(limits->active & LIMIT_RSS)))
+            {
+                return false;
+            }
+            return limits->active != 0;
+        }
+
+        if (seconds != NULL && length == (int)strlen(FOR_KEYWORD) && memcmp(option, FOR_KEYWORD, length) == 0)
+        {
+            while (line < end && isBlank(*line))
+            {
+                ++line;
+            }
+            option = line;
+            while (line < end && !isBlank(*line))
+            {
+                ++line;
+            }
+            if (!parseSeconds(option, (int)(line - option), seconds))
+            {
+                return false;
+            }
+            seconds = NULL;
+            continue;
+        }
+        seconds = NULL;
+        if (length == (int)strlen(RECLAIM_OPTION) && memcmp(option, RECLAIM_OPTION, length) == 0 && !limits->reclaim)
+        {
+            limits->reclaim = true;
+            continue;
+        }
+        if (!parseLimitOption(option, length, limits, &seconds) && !parseKillOption(option, length, limits, &hasGrace)
+            && !parseChildrenOption(option, length, limits) && !parseThrottleOption(option, length, limits, &hasSoft)
+            && !parsePriorityOption(option, length, limits) && !parseRequestOption(option, length, predicates))
         {
-            freeOutputFromProgram(config, configLines);
+            return false;
         }
-        saveLogReport(report);
-        return -1;
     }
+}
+
+//private
+size_t getPredicatesSize(const RequestPredicates* predicates)
+{
+    size_t size = 0;
+    int i;
+    for (i = 0; i < predicates->argvCount; ++i)
+    {
+        size += predicates->argvLength[i] + 1;
+    }
+    if (predicates->predicates & PREDICATE_PARENT)
+    {
+        size += predicates->parentNameLength + 1;
+    }
+    return size;
+}
+
+//private
+bool isEmptyLine(const char* line, const char* end)
+{
+    while (line < end && isBlank(*line))
+    {
+        ++line;
+    }
+    return line == end;
+}
 
-    // Array of MonitorRequest pointers
-    MonitorRequest** requests = (MonitorRequest**)malloc(configLines*sizeof(MonitorRequest*));
-    if (!checkMallocResult(requests, &report))
+//private
+RequestKind getRequestKind(const char* name, int nameLength)
+{
+    if (hasPrefix(name, nameLength, GLOB_PREFIX))
+    {
+        return GLOB_PATTERN;
+    }
+    if (hasPrefix(name, nameLength, REGEX_PREFIX))
     {
-        freeOutputFromProgram(config, configLines);
-        saveLogReport(report);
-        return -1;
+        return REGEX_PATTERN;
     }
+    if (hasPrefix(name, nameLength, EXE_PREFIX))
+    {
+        return EXE_PATH;
+    }
+    if (hasPrefix(name, nameLength, CGROUP_PREFIX))
+    {
+        return CGROUP_PATH;
+    }
+    return EXACT_NAME;
+}
 
+//private
+// The identity of the file an exe: rule names. False if it doesn't exist (yet).
+bool resolveExe(const char* name, int nameLength, dev_t* device, ino_t* inode)
+{
+    char path[PATH_MAX];
+    int length = nameLength - strlen(EXE_PREFIX);
+    if (length >= (int)sizeof(path))
+    {
+        return false;
+    }
+    memcpy(path, name + strlen(EXE_PREFIX), length);
+    path[length] = '\0';
+
+    struct stat info;
+    if (stat(path, &info) < 0)
+    {
+        return false;
+    }
+    *device = info.st_dev;
+    *inode = info.st_ino;
+    return true;
+}
+
+//private
+// "cgroup:/a/b/" and "cgroup:/a/b" are the same rule, so the trailing slashes go
+int trimCgroupPath(const char* name, int nameLength)
+{
+    int minimumLength = strlen(CGROUP_PREFIX) + 1;
+    while (nameLength > minimumLength && name[nameLength - 1] == '/')
+    {
+        --nameLength;
+    }
+    return nameLength;
+}
+
+//private
+int countCgroupComponents(const char* name, int nameLength)
+{
+    int count = 0;
     int i;
-    for (i = 0; i < configLines; ++i)
+    for (i = strlen(CGROUP_PREFIX); i < nameLength; ++i)
+    {
+        if (name[i] != '/' && (i == (int)strlen(CGROUP_PREFIX) || name[i - 1] == '/'))
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+//private
+const char* getLineEnd(const char* line, const char* fileEnd)
+{
+    const char* newline = (const char*)memchr(line, '\n', fileEnd - line);
+    return newline == NULL ? fileEnd : newline;
+}
+
+// Compiles the config file into a new RuleSet, diffed against base. Runs on the config compiler thread,
+// so errors are only put in the report, never logged from here.
+RuleSet* getProcessesToMonitor(const char* configPath, const RuleSet* base, LogReport* report)
+{
+    long long started = getMonotonicMillis();
+    report->message = (char*)NULL;
+    size_t size = 0;
+    const char* config = (const char*)loadFile(configPath, &size, report);
+
+    if (report->message != NULL)
     {
-        MonitorRequest* request = constructMonitorRequest(config[i]);
+        return NULL;
+    }
+
+    if (isRuleSetImage(config, size))
+    {
+        // Compiled by procnanny-compile. Used in place, without diffing it against base.
+        unloadFile((void*)config, size);
+        return loadRuleSetImage(configPath, report);
+    }
 
-        if (request == NULL)
+    PatternCompiler patterns;
+    if (!initPatternCompiler(&patterns))
+    {
+        destroyPatternCompiler(&patterns);
+        unloadFile((void*)config, size);
+        report->message = "Out of memory.";
+        report->type = DEBUG;
+        return NULL;
+    }
+
+    // First pass: size the set, and compile the patterns
+    const char* configEnd = config + size;
+    const char* line;
+    const char* name;
+    int nameLength;
+    unsigned long int duration;
+    RequestPredicates predicates;
+    ResourceLimits limits;
+    RuleSetSizes sizes;
+    memset(&sizes, 0, sizeof(RuleSetSizes));
+    int ignoredLines = 0;
+    int unresolvedRules = 0;
+    dev_t device;
+    ino_t inode;
+    bool patternsValid = true;
+    for (line = config; line < configEnd && patternsValid; line = getLineEnd(line, configEnd) + 1)
+    {
+        const char* lineEnd = getLineEnd(line, configEnd);
+        if (!parseRequestLine(line, lineEnd, &name, &nameLength, &duration, &predicates, &limits))
+        {
+            if (!isEmptyLine(line, lineEnd))
+            {
+                ++ignoredLines;
+            }
+            continue;
+        }
+
+        bool isUnresolved = predicates.isUnresolved;
+        switch (getRequestKind(name, nameLength))
+        {
+            case EXE_PATH:
+                ++sizes.exeRequestCount;
+                isUnresolved = isUnresolved || !resolveExe(name, nameLength, &device, &inode);
+                break;
+            case CGROUP_PATH:
+                nameLength = trimCgroupPath(name, nameLength);
+                sizes.cgroupComponentCount += countCgroupComponents(name, nameLength);
+                break;
+            case GLOB_PATTERN:
+                patternsValid = addGlobPattern(&patterns, name + strlen(GLOB_PREFIX), nameLength - strlen(GLOB_PREFIX), sizes.requestCount);
+                break;
+            case REGEX_PATTERN:
+                patternsValid = addRegexPattern(&patterns, name + strlen(REGEX_PREFIX), nameLength - strlen(REGEX_PREFIX), sizes.requestCount);
+                break;
+            default:
+                break;
+        }
+        ++sizes.requestCount;
+        sizes.namesSize += nameLength + 1 + getPredicatesSize(&predicates);
+        sizes.argvWordCount += predicates.argvCount;
+        if (predicates.predicates & PREDICATE_UID)
+        {
+            ++sizes.uidRequestCount;
+        }
+        if (isUnresolved)
+        {
+            ++unresolvedRules;
+        }
+    }
+
+    if (!patternsValid || !buildPatternDFA(&patterns))
+    {
+        destroyPatternCompiler(&patterns);
+        unloadFile((void*)config, size);
+        report->message = patternsValid ? "Glob and regex rules in the config are too complex to compile." : "Invalid glob or regex rule in the config.";
+        report->type = ERROR;
+        return NULL;
+    }
+
+    sizes.dfaSize = getPatternDFASize(&patterns);
+    RuleSet* set = allocateRuleSet(&sizes);
+    if (set == NULL)
+    {
+        destroyPatternCompiler(&patterns);
+        unloadFile((void*)config, size);
+        report->message = "Out of memory.";
+        report->type = DEBUG;
+        return NULL;
+    }
+    if (set->dfaSize > 0)
+    {
+        writePatternDFA(&patterns, getPatternDFA(set));
+    }
+    destroyPatternCompiler(&patterns);
+
+    // Second pass: fill it
+    for (line = config; line < configEnd; line = getLineEnd(line, configEnd) + 1)
+    {
+        if (!parseRequestLine(line, getLineEnd(line, configEnd), &name, &nameLength, &duration, &predicates, &limits))
+        {
+            continue;
+        }
+
+        RequestKind kind = getRequestKind(name, nameLength);
+        if (kind == CGROUP_PATH)
+        {
+            nameLength = trimCgroupPath(name, nameLength);
+        }
+        MonitorRequest* request = addMonitorRequest(set, kind, name, nameLength, duration, &predicates);
+        request->limits = limits;
+        if (kind == EXE_PATH && resolveExe(name, nameLength, &device, &inode))
         {
-            freeOutputFromProgram(config, configLines);
-            destroyMonitorRequestArray(requests, configLines);
-            return -1;
+            request->exeDevice = device;
+            request->exeInode = inode;
         }
-        requests[i] = request;
     }
 
-    freeOutputFromProgram(config, configLines);
-    *monitorRequests = requests;
-    return configLines;
+    unloadFile((void*)config, size);
+    finishRuleSet(set, base);
+    set->ignoredLines = ignoredLines;
+    set->unresolvedRules = unresolvedRules;
+    set->compileMillis = getMonotonicMillis() - started;
+    return set;
 }
\ No newline at end of file
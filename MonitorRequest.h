@@ -17,15 +17,116 @@ limitations under the License.
 #ifndef __MONITOR_REQUEST_H__
 #define __MONITOR_REQUEST_H__
 
+#include <stdbool.h>
+#include <sys/types.h>
+#include <signal.h>
+#include "Logging.h"
+
+typedef enum { EXACT_NAME, GLOB_PATTERN, REGEX_PATTERN, EXE_PATH, CGROUP_PATH } RequestKind;
+
+extern const char* CGROUP_PREFIX;
+
+// Optional conditions a matching process also has to meet, from "uid=", "user=", "argv=" and "parent="
+// options after the duration. They are checked in this order, cheapest first.
+#define PREDICATE_UID 1u
+#define PREDICATE_ARGV 2u
+#define PREDICATE_PARENT 4u
+#define MAX_ARGV_PREDICATES 8
+
+// What gets a matching process killed: running for longer than the duration, and the "rss>", "cpu>",
+// "cputime>" and "idle>" options. A rule has at least one. All but the duration are enforced by sampling.
+#define LIMIT_WALL_TIME 1u
+#define LIMIT_RSS 2u
+#define LIMIT_CPU 4u
+#define LIMIT_CPU_TIME 8u
+#define LIMIT_IDLE 16u
+#define SAMPLED_LIMITS (LIMIT_RSS | LIMIT_CPU | LIMIT_CPU_TIME | LIMIT_IDLE)
+// "children=": whether the descendants of a matching process are monitored too, and if so, whether they share
+// its deadline or each get the whole duration from when they are found
+#define CHILDREN_NONE 0
+#define CHILDREN_INHERIT 1
+#define CHILDREN_SEPARATE 2
+
+// Given a "signal=" without a "grace=", or the other way around
+#define DEFAULT_GRACE_SECONDS 10
+#define DEFAULT_KILL_SIGNAL SIGTERM
+// Given a "soft=" without a "throttle="
+#define DEFAULT_THROTTLE_CPU 10
+
+typedef struct
+{
+	unsigned int active;
+	// In KiB
+	unsigned long long rss;
+	// Percent of one CPU
+	unsigned int cpu;
+	// How long rss and cpu have to stay over the limit, in seconds. From a "for" after the option.
+	unsigned int rssSeconds;
+	unsigned int cpuSeconds;
+	// User plus system time, in seconds
+	unsigned int cpuTime;
+	// How long the CPU time may stay the same, in seconds
+	unsigned int idleSeconds;
+	// How a process over any of them is killed: with signal first, then SIGKILL if it is still running
+	// graceSeconds later. 0 to send SIGKILL straight away.
+	int signal;
+	unsigned int graceSeconds;
+	// "kill=tree": whatever the process started goes with it, see signalProcessTree
+	bool killTree;
+	unsigned char children;
+	// "soft=TIME": softSeconds into the duration, the process is throttled to throttleCpu percent of one CPU
+	// ("throttle=N%"), before it is killed at the end. throttleCpu is 0 without a soft=.
+	unsigned int softSeconds;
+	unsigned int throttleCpu;
+	// "reclaim": a process over its rss> limit gets its memory paged out once before it is killed for it
+	bool reclaim;
+	// "priority=N": the process may be killed to relieve memory pressure, before those with a higher N (see
+	// relievePressure). 0 without one.
+	unsigned int priority;
+} ResourceLimits;
+
+// Predicates as parsed from a config line, pointing into the line
+typedef struct
+{
+	unsigned int predicates;
+	uid_t uid;
+	const char* argv[MAX_ARGV_PREDICATES];
+	int argvLength[MAX_ARGV_PREDICATES];
+	int argvCount;
+	const char* parentName;
+	int parentNameLength;
+	// A user= that doesn't exist. The request is kept, but can never match.
+	bool isUnresolved;
+} RequestPredicates;
+
 typedef struct
 {
-	char* processName;
+	RequestKind kind;
+	// Into the names of the RuleSet holding this request
+	unsigned int processNameOffset;
+	unsigned int processNameLength;
 	unsigned long int monitorDuration;
+	ResourceLimits limits;
+	unsigned int predicates;
+	uid_t uid;
+	// argvCount NUL terminated tokens, back to back in the names
+	unsigned int argvOffset;
+	unsigned int argvCount;
+	unsigned int parentNameOffset;
+	// The file an exe: request names, as resolved when the config was loaded. 0 if it didn't exist.
+	dev_t exeDevice;
+	ino_t exeInode;
+	// Index + 1 of the next request for the same name with other predicates, in config order. 0 if none.
+	unsigned int nextAlternative;
+	// Added, or its duration or limits changed, relative to the previous config
+	bool isNew;
+	// Overridden by a later line for the same process name and predicates
+	bool isDuplicate;
 } MonitorRequest;
 
-MonitorRequest* constructMonitorRequest(char* requestString);
-void destroyMonitorRequest(MonitorRequest* this);
-void destroyMonitorRequestArray(MonitorRequest** requestArray, int size);
-int getProcessesToMonitor(int argc, char** argv, MonitorRequest*** monitorRequests);
+struct ruleSet;
+struct ruleSet* getProcessesToMonitor(const char* configPath, const struct ruleSet* base, LogReport* report);
+bool hasSameLimits(const ResourceLimits* first, const ResourceLimits* second);
+const char* getSignalName(int signal);
 
 #endif
\ No newline at end of file
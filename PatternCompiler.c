@@ -0,0 +1,1024 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "PatternCompiler.h"
+#include <string.h>
+#include <sys/mman.h>
+#include "memwatch.h"
+
+// Patterns are parsed into one Thompson NFA (an alternation of all of them), which is then turned into a
+// DFA by subset construction. Bytes that no pattern tells apart share a byte class, which keeps the
+// transition table small. Each DFA state lists, in config order, every request whose pattern ends in it.
+
+#define NODE_CHAR 0
+#define NODE_EPSILON 1
+#define NODE_SPLIT 2
+#define NODE_MATCH 3
+
+#define NO_NODE -1
+#define DEAD_STATE 0
+#define START_STATE 1
+#define MAX_DFA_STATES 65536
+#define REGION_SIZE ((size_t)1 << 28)
+
+typedef struct
+{
+    unsigned char type;
+    int out1;
+    int out2;
+    int requestIndex;
+    unsigned char set[32];
+} NfaNode;
+
+// end is always an epsilon node whose out1 is still unset
+typedef struct
+{
+    int begin;
+    int end;
+} Fragment;
+
+typedef struct
+{
+    size_t setOffset;
+    int setLength;
+    unsigned int hash;
+    // Match nodes in the set, not counting the sticky ones
+    int acceptCount;
+} DfaState;
+
+// What writePatternDFA produces: this, then unsigned int acceptStart[stateCount + 1], then
+// int accepts[acceptCount], then unsigned int transitions[stateCount*classCount]. The requests
+// accepted by state s are accepts[acceptStart[s]] to accepts[acceptStart[s + 1] - 1].
+typedef struct
+{
+    unsigned int stateCount;
+    unsigned int classCount;
+    unsigned int acceptCount;
+    unsigned char byteClass[256];
+} PatternDFA;
+
+typedef struct
+{
+    PatternCompiler* compiler;
+    const char* text;
+    int length;
+    int position;
+    bool failed;
+} PatternParser;
+
+//private
+bool reserveRegion(ScratchRegion* region)
+{
+    region->used = 0;
+    region->reserved = REGION_SIZE;
+    region->base = (char*)mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region->base == MAP_FAILED)
+    {
+        region->base = NULL;
+        return false;
+    }
+    return true;
+}
+
+//private
+void releaseRegion(ScratchRegion* region)
+{
+    if (region->base != NULL)
+    {
+        munmap(region->base, region->reserved);
+        region->base = NULL;
+    }
+}
+
+//private
+void* allocateFromRegion(ScratchRegion* region, size_t size)
+{
+    // Every region holds one type, all of them multiples of 4 (or 8) bytes big, so consecutive
+    // allocations stay aligned and arrays built a piece at a time stay contiguous
+    size = (size + 3) & ~(size_t)3;
+    if (region->base == NULL || region->used + size > region->reserved)
+    {
+        return NULL;
+    }
+    void* allocated = region->base + region->used;
+    region->used += size;
+    return allocated;
+}
+
+//private
+NfaNode* getNode(PatternCompiler* this, int index)
+{
+    return (NfaNode*)this->nodes.base + index;
+}
+
+//private
+int getNodeCount(PatternCompiler* this)
+{
+    return (int)(this->nodes.used/sizeof(NfaNode));
+}
+
+//private
+int addNode(PatternParser* parser, unsigned char type, int out1, int out2)
+{
+    NfaNode* node = (NfaNode*)allocateFromRegion(&parser->compiler->nodes, sizeof(NfaNode));
+    if (node == NULL)
+    {
+        parser->failed = true;
+        return NO_NODE;
+    }
+    memset(node, 0, sizeof(NfaNode));
+    node->type = type;
+    node->out1 = out1;
+    node->out2 = out2;
+    return getNodeCount(parser->compiler) - 1;
+}
+
+//private
+Fragment emptyFragment(PatternParser* parser)
+{
+    Fragment fragment;
+    fragment.begin = addNode(parser, NODE_EPSILON, NO_NODE, NO_NODE);
+    fragment.end = fragment.begin;
+    return fragment;
+}
+
+//private
+Fragment setFragment(PatternParser* parser, const unsigned char* set)
+{
+    Fragment fragment;
+    fragment.end = addNode(parser, NODE_EPSILON, NO_NODE, NO_NODE);
+    fragment.begin = addNode(parser, NODE_CHAR, fragment.end, NO_NODE);
+    if (!parser->failed)
+    {
+        memcpy(getNode(parser->compiler, fragment.begin)->set, set, 32);
+    }
+    return fragment;
+}
+
+//private
+void addToSet(unsigned char* set, unsigned char c)
+{
+    set[c >> 3] |= (unsigned char)(1 << (c & 7));
+}
+
+//private
+bool isInSet(const unsigned char* set, unsigned char c)
+{
+    return (set[c >> 3] & (1 << (c & 7))) != 0;
+}
+
+//private
+Fragment byteFragment(PatternParser* parser, unsigned char c)
+{
+    unsigned char set[32];
+    memset(set, 0, sizeof(set));
+    addToSet(set, c);
+    return setFragment(parser, set);
+}
+
+//private
+Fragment anyByteFragment(PatternParser* parser)
+{
+    unsigned char set[32];
+    memset(set, 0xff, sizeof(set));
+    return setFragment(parser, set);
+}
+
+//private
+Fragment concatenate(PatternParser* parser, Fragment first, Fragment second)
+{
+    if (parser->failed)
+    {
+        return first;
+    }
+    getNode(parser->compiler, first.end)->out1 = second.begin;
+    first.end = second.end;
+    return first;
+}
+
+//private
+Fragment alternate(PatternParser* parser, Fragment first, Fragment second)
+{
+    Fragment fragment;
+    fragment.end = addNode(parser, NODE_EPSILON, NO_NODE, NO_NODE);
+    fragment.begin = addNode(parser, NODE_SPLIT, first.begin, second.begin);
+    if (!parser->failed)
+    {
+        getNode(parser->compiler, first.end)->out1 = fragment.end;
+        getNode(parser->compiler, second.end)->out1 = fragment.end;
+    }
+    return fragment;
+}
+
+//private
+// operation is one of * + ?
+Fragment repeat(PatternParser* parser, Fragment inner, char operation)
+{
+    Fragment fragment;
+    fragment.end = addNode(parser, NODE_EPSILON, NO_NODE, NO_NODE);
+    int split = addNode(parser, NODE_SPLIT, inner.begin, fragment.end);
+    if (parser->failed)
+    {
+        return inner;
+    }
+    getNode(parser->compiler, inner.end)->out1 = operation == '?' ? fragment.end : split;
+    fragment.begin = operation == '+' ? inner.begin : split;
+    return fragment;
+}
+
+//private
+bool atEnd(PatternParser* parser)
+{
+    return parser->position >= parser->length;
+}
+
+//private
+char peek(PatternParser* parser)
+{
+    return parser->text[parser->position];
+}
+
+//private
+// Adds the escape classes \d \w \s to set, or the escaped byte itself
+void addEscapeToSet(unsigned char* set, char c)
+{
+    int b;
+    switch (c)
+    {
+        case 'd':
+            for (b = '0'; b <= '9'; ++b) addToSet(set, (unsigned char)b);
+            break;
+        case 'w':
+            for (b = '0'; b <= '9'; ++b) addToSet(set, (unsigned char)b);
+            for (b = 'a'; b <= 'z'; ++b) addToSet(set, (unsigned char)b);
+            for (b = 'A'; b <= 'Z'; ++b) addToSet(set, (unsigned char)b);
+            addToSet(set, '_');
+            break;
+        case 's':
+            addToSet(set, ' ');
+            addToSet(set, '\t');
+            break;
+        default:
+            addToSet(set, (unsigned char)c);
+            break;
+    }
+}
+
+//private
+// After the opening '['. Both "[!...]" (glob) and "[^...]" negate.
+Fragment parseBracket(PatternParser* parser)
+{
+    unsigned char set[32];
+    memset(set, 0, sizeof(set));
+    bool negated = false;
+    if (!atEnd(parser) && (peek(parser) == '^' || peek(parser) == '!'))
+    {
+        negated = true;
+        parser->position++;
+    }
+
+    bool first = true;
+    while (!atEnd(parser) && (peek(parser) != ']' || first))
+    {
+        first = false;
+        unsigned char low = (unsigned char)parser->text[parser->position++];
+        if (low == '\\' && !atEnd(parser))
+        {
+            addEscapeToSet(set, parser->text[parser->position++]);
+            continue;
+        }
+
+        unsigned char high = low;
+        if (parser->position + 1 < parser->length && peek(parser) == '-' && parser->text[parser->position + 1] != ']')
+        {
+            high = (unsigned char)parser->text[parser->position + 1];
+            parser->position += 2;
+        }
+        int b;
+        for (b = low; b <= high; ++b)
+        {
+            addToSet(set, (unsigned char)b);
+        }
+    }
+
+    if (atEnd(parser))
+    {
+        // No closing ']'
+        parser->failed = true;
+        return emptyFragment(parser);
+    }
+    parser->position++;
+
+    if (negated)
+    {
+        int i;
+        for (i = 0; i < 32; ++i)
+        {
+            set[i] = (unsigned char)~set[i];
+        }
+    }
+    return setFragment(parser, set);
+}
+
+Fragment parseAlternation(PatternParser* parser);
+
+//private
+Fragment parseAtom(PatternParser* parser)
+{
+    char c = parser->text[parser->position++];
+    switch (c)
+    {
+        case '(':
+        {
+            Fragment inner = parseAlternation(parser);
+            if (atEnd(parser) || peek(parser) != ')')
+            {
+                parser->failed = true;
+                return inner;
+            }
+            parser->position++;
+            return inner;
+        }
+        case '.':
+            return anyByteFragment(parser);
+        case '[':
+            return parseBracket(parser);
+        case '\\':
+        {
+            if (atEnd(parser))
+            {
+                parser->failed = true;
+                return emptyFragment(parser);
+            }
+            unsigned char set[32];
+            memset(set, 0, sizeof(set));
+            addEscapeToSet(set, parser->text[parser->position++]);
+            return setFragment(parser, set);
+        }
+        case '^':
+            // Rules are always anchored, so anchors at the ends are no-ops
+            if (parser->position == 1)
+            {
+                return emptyFragment(parser);
+            }
+            break;
+        case '$':
+            if (atEnd(parser))
+            {
+                return emptyFragment(parser);
+            }
+            break;
+        case '*':
+        case '+':
+        case '?':
+            // Nothing to repeat
+            parser->failed = true;
+            return emptyFragment(parser);
+    }
+    return byteFragment(parser, (unsigned char)c);
+}
+
+//private
+Fragment parseConcatenation(PatternParser* parser)
+{
+    Fragment fragment = emptyFragment(parser);
+    while (!parser->failed && !atEnd(parser) && peek(parser) != '|' && peek(parser) != ')')
+    {
+        Fragment atom = parseAtom(parser);
+        while (!parser->failed && !atEnd(parser) && (peek(parser) == '*' || peek(parser) == '+' || peek(parser) == '?'))
+        {
+            atom = repeat(parser, atom, parser->text[parser->position++]);
+        }
+        fragment = concatenate(parser, fragment, atom);
+    }
+    return fragment;
+}
+
+Fragment parseAlternation(PatternParser* parser)
+{
+    Fragment fragment = parseConcatenation(parser);
+    while (!parser->failed && !atEnd(parser) && peek(parser) == '|')
+    {
+        parser->position++;
+        fragment = alternate(parser, fragment, parseConcatenation(parser));
+    }
+    return fragment;
+}
+
+//private
+Fragment parseGlob(PatternParser* parser)
+{
+    Fragment fragment = emptyFragment(parser);
+    while (!parser->failed && !atEnd(parser))
+    {
+        char c = parser->text[parser->position++];
+        Fragment atom;
+        if (c == '*')
+        {
+            atom = repeat(parser, anyByteFragment(parser), '*');
+        }
+        else if (c == '?')
+        {
+            atom = anyByteFragment(parser);
+        }
+        else if (c == '[')
+        {
+            atom = parseBracket(parser);
+        }
+        else if (c == '\\' && !atEnd(parser))
+        {
+            atom = byteFragment(parser, (unsigned char)parser->text[parser->position++]);
+        }
+        else
+        {
+            atom = byteFragment(parser, (unsigned char)c);
+        }
+        fragment = concatenate(parser, fragment, atom);
+    }
+    return fragment;
+}
+
+//private
+// Hooks a parsed pattern into the alternation of all patterns
+bool addPattern(PatternCompiler* this, PatternParser* parser, Fragment fragment, int requestIndex)
+{
+    if (parser->failed || !atEnd(parser))
+    {
+        return false;
+    }
+
+    int match = addNode(parser, NODE_MATCH, NO_NODE, NO_NODE);
+    int start = addNode(parser, NODE_SPLIT, fragment.begin, this->start);
+    if (parser->failed)
+    {
+        return false;
+    }
+    getNode(this, match)->requestIndex = requestIndex;
+    getNode(this, fragment.end)->out1 = match;
+    this->start = start;
+    this->patternCount++;
+    return true;
+}
+
+bool addGlobPattern(PatternCompiler* this, const char* pattern, int length, int requestIndex)
+{
+    PatternParser parser = { this, pattern, length, 0, false };
+    Fragment fragment = parseGlob(&parser);
+    return addPattern(this, &parser, fragment, requestIndex);
+}
+
+bool addRegexPattern(PatternCompiler* this, const char* pattern, int length, int requestIndex)
+{
+    PatternParser parser = { this, pattern, length, 0, false };
+    Fragment fragment = parseAlternation(&parser);
+    return addPattern(this, &parser, fragment, requestIndex);
+}
+
+bool initPatternCompiler(PatternCompiler* this)
+{
+    memset(this, 0, sizeof(PatternCompiler));
+    this->start = NO_NODE;
+    return reserveRegion(&this->nodes) && reserveRegion(&this->stateSets) && reserveRegion(&this->states)
+        && reserveRegion(&this->stateHash) && reserveRegion(&this->transitions) && reserveRegion(&this->work)
+        && reserveRegion(&this->stickyAccepts);
+}
+
+void destroyPatternCompiler(PatternCompiler* this)
+{
+    releaseRegion(&this->nodes);
+    releaseRegion(&this->stateSets);
+    releaseRegion(&this->states);
+    releaseRegion(&this->stateHash);
+    releaseRegion(&this->transitions);
+    releaseRegion(&this->work);
+    releaseRegion(&this->stickyAccepts);
+}
+
+//private
+void computeByteClasses(PatternCompiler* this)
+{
+    memset(this->byteClass, 0, sizeof(this->byteClass));
+    this->classCount = 1;
+    int nodeCount = getNodeCount(this);
+    int i;
+    for (i = 0; i < nodeCount; ++i)
+    {
+        NfaNode* node = getNode(this, i);
+        if (node->type != NODE_CHAR)
+        {
+            continue;
+        }
+
+        // Split every existing class by membership in this node's set
+        int split[256][2];
+        memset(split, -1, sizeof(split));
+        int classCount = 0;
+        int b;
+        for (b = 0; b < 256; ++b)
+        {
+            int* newClass = &split[this->byteClass[b]][isInSet(node->set, (unsigned char)b) ? 1 : 0];
+            if (*newClass < 0)
+            {
+                *newClass = classCount++;
+            }
+            this->byteClass[b] = (unsigned char)*newClass;
+        }
+        this->classCount = classCount;
+    }
+}
+
+//private
+void sortInts(int* values, int count)
+{
+    int i;
+    for (i = 1; i < count; ++i)
+    {
+        int value = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > value)
+        {
+            values[j + 1] = values[j];
+            --j;
+        }
+        values[j + 1] = value;
+    }
+}
+
+//private
+DfaState* getState(PatternCompiler* this, int index)
+{
+    return (DfaState*)this->states.base + index;
+}
+
+//private
+int* getStateSet(PatternCompiler* this, DfaState* state)
+{
+    return (int*)this->stateSets.base + state->setOffset;
+}
+
+//private
+// Epsilon closure of the seeds (leaving out sticky nodes), sorted. Returns its size. Large closures are sorted through the members
+// bitmap (one bit per NFA node, left all clear), small ones by insertion.
+int computeClosure(PatternCompiler* this, int* seeds, int seedCount, const unsigned char* sticky, int* marks, int generation,
+    int* stack, unsigned long long* members, int* closure)
+{
+    int stackSize = 0;
+    int closureSize = 0;
+    int i;
+    for (i = 0; i < seedCount; ++i)
+    {
+        stack[stackSize++] = seeds[i];
+    }
+
+    while (stackSize > 0)
+    {
+        int index = stack[--stackSize];
+        if (index == NO_NODE || marks[index] == generation || (sticky != NULL && sticky[index]))
+        {
+            continue;
+        }
+        marks[index] = generation;
+
+        NfaNode* node = getNode(this, index);
+        if (node->type == NODE_EPSILON)
+        {
+            stack[stackSize++] = node->out1;
+        }
+        else if (node->type == NODE_SPLIT)
+        {
+            stack[stackSize++] = node->out2;
+            stack[stackSize++] = node->out1;
+        }
+        else
+        {
+            closure[closureSize++] = index;
+        }
+    }
+
+    if (closureSize < 64)
+    {
+        sortInts(closure, closureSize);
+        return closureSize;
+    }
+
+    int lowestWord = getNodeCount(this);
+    int highestWord = 0;
+    for (i = 0; i < closureSize; ++i)
+    {
+        int word = closure[i] >> 6;
+        members[word] |= 1ULL << (closure[i] & 63);
+        lowestWord = word < lowestWord ? word : lowestWord;
+        highestWord = word > highestWord ? word : highestWord;
+    }
+    closureSize = 0;
+    int word;
+    for (word = lowestWord; word <= highestWord; ++word)
+    {
+        while (members[word] != 0)
+        {
+            closure[closureSize++] = (word << 6) + __builtin_ctzll(members[word]);
+            members[word] &= members[word] - 1;
+        }
+    }
+    return closureSize;
+}
+
+//private
+// Index of the DFA state for this NFA state set, adding it if it is new. -1 if there are too many states.
+int findOrAddState(PatternCompiler* this, int* set, int setLength)
+{
+    if (setLength == 0 && !this->hasSticky)
+    {
+        return DEAD_STATE;
+    }
+
+    unsigned int hash = 2166136261u;
+    int i;
+    for (i = 0; i < setLength; ++i)
+    {
+        hash = (hash ^ (unsigned int)set[i])*16777619u;
+    }
+
+    unsigned int* slots = (unsigned int*)this->stateHash.base;
+    unsigned int mask = MAX_DFA_STATES*2 - 1;
+    unsigned int slot = hash & mask;
+    while (slots[slot] != 0)
+    {
+        DfaState* state = getState(this, slots[slot] - 1);
+        if (state->hash == hash && state->setLength == setLength
+            && memcmp(getStateSet(this, state), set, setLength*sizeof(int)) == 0)
+        {
+            return (int)slots[slot] - 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (this->stateCount >= MAX_DFA_STATES)
+    {
+        return -1;
+    }
+
+    DfaState* state = (DfaState*)allocateFromRegion(&this->states, sizeof(DfaState));
+    int* stored = (int*)allocateFromRegion(&this->stateSets, setLength*sizeof(int));
+    if (state == NULL || stored == NULL)
+    {
+        return -1;
+    }
+    memcpy(stored, set, setLength*sizeof(int));
+    state->setOffset = (size_t)(stored - (int*)this->stateSets.base);
+    state->setLength = setLength;
+    state->hash = hash;
+    state->acceptCount = 0;
+    for (i = 0; i < setLength; ++i)
+    {
+        if (getNode(this, set[i])->type == NODE_MATCH)
+        {
+            state->acceptCount++;
+        }
+    }
+
+    slots[slot] = (unsigned int)++this->stateCount;
+    return this->stateCount - 1;
+}
+
+//private
+// Marks an any-byte loop node and its epsilon closure after reading a byte
+void markSticky(PatternCompiler* this, int index, unsigned char* sticky, int* stack)
+{
+    sticky[index] = 1;
+    int stackSize = 0;
+    stack[stackSize++] = getNode(this, index)->out1;
+    while (stackSize > 0)
+    {
+        index = stack[--stackSize];
+        if (index == NO_NODE || sticky[index])
+        {
+            continue;
+        }
+        sticky[index] = 1;
+
+        NfaNode* node = getNode(this, index);
+        if (node->type == NODE_EPSILON || node->type == NODE_SPLIT)
+        {
+            stack[stackSize++] = node->out1;
+        }
+        if (node->type == NODE_SPLIT)
+        {
+            stack[stackSize++] = node->out2;
+        }
+    }
+}
+
+//private
+// Merges two sorted lists without duplicates. Returns the merged size.
+int mergeSorted(const int* first, int firstLength, const int* second, int secondLength, int* merged)
+{
+    int i = 0;
+    int j = 0;
+    int length = 0;
+    while (i < firstLength || j < secondLength)
+    {
+        if (j == secondLength || (i < firstLength && first[i] < second[j]))
+        {
+            merged[length++] = first[i++];
+        }
+        else if (i == firstLength || second[j] < first[i])
+        {
+            merged[length++] = second[j++];
+        }
+        else
+        {
+            merged[length++] = first[i++];
+            ++j;
+        }
+    }
+    return length;
+}
+
+// Subset construction. Patterns that start with a wildcard (like "*fooproc") would put their any-byte loop,
+// and everything it leads to, in every single DFA state. Those nodes are sticky: once active, always active.
+// They are left out of the state sets and their moves are computed once per byte class, which keeps the cost
+// proportional to the progress made into the patterns rather than to their number.
+bool buildPatternDFA(PatternCompiler* this)
+{
+    if (this->patternCount == 0)
+    {
+        return true;
+    }
+
+    computeByteClasses(this);
+    unsigned char representative[256];
+    int b;
+    for (b = 255; b >= 0; --b)
+    {
+        representative[this->byteClass[b]] = (unsigned char)b;
+    }
+
+    int nodeCount = getNodeCount(this);
+    int* marks = (int*)allocateFromRegion(&this->work, nodeCount*sizeof(int));
+    int* stack = (int*)allocateFromRegion(&this->work, nodeCount*2*sizeof(int));
+    int* closure = (int*)allocateFromRegion(&this->work, nodeCount*sizeof(int));
+    int* merged = (int*)allocateFromRegion(&this->work, nodeCount*sizeof(int));
+    int* seeds = (int*)allocateFromRegion(&this->work, nodeCount*sizeof(int));
+    unsigned char* sticky = (unsigned char*)allocateFromRegion(&this->work, nodeCount);
+    unsigned long long* members = (unsigned long long*)allocateFromRegion(&this->work, (nodeCount/64 + 1)*sizeof(unsigned long long));
+    int* stickyMoveOffsets = (int*)allocateFromRegion(&this->work, (this->classCount + 1)*sizeof(int));
+    if (marks == NULL || stack == NULL || closure == NULL || merged == NULL || seeds == NULL || sticky == NULL
+        || members == NULL || stickyMoveOffsets == NULL
+        || allocateFromRegion(&this->stateHash, MAX_DFA_STATES*2*sizeof(unsigned int)) == NULL)
+    {
+        return false;
+    }
+    int generation = 0;
+
+    // Find the sticky nodes: any-byte nodes in the start closure that loop back to themselves
+    seeds[0] = this->start;
+    int startLength = computeClosure(this, seeds, 1, NULL, marks, ++generation, stack, members, closure);
+    int* start = (int*)allocateFromRegion(&this->work, (startLength + 1)*sizeof(int));
+    if (start == NULL)
+    {
+        return false;
+    }
+    memcpy(start, closure, startLength*sizeof(int));
+
+    int i;
+    for (i = 0; i < startLength; ++i)
+    {
+        NfaNode* node = getNode(this, start[i]);
+        unsigned char all[32];
+        memset(all, 0xff, sizeof(all));
+        if (sticky[start[i]] || node->type != NODE_CHAR || memcmp(node->set, all, sizeof(all)) != 0)
+        {
+            continue;
+        }
+
+        seeds[0] = node->out1;
+        int length = computeClosure(this, seeds, 1, NULL, marks, ++generation, stack, members, closure);
+        int j;
+        for (j = 0; j < length && closure[j] != start[i]; ++j);
+        if (j < length)
+        {
+            markSticky(this, start[i], sticky, stack);
+            this->hasSticky = true;
+        }
+    }
+
+    // Nodes are numbered in config order, so this comes out sorted
+    this->stickyAcceptCount = 0;
+    for (i = 0; i < nodeCount; ++i)
+    {
+        NfaNode* node = getNode(this, i);
+        if (sticky[i] && node->type == NODE_MATCH)
+        {
+            int* accept = (int*)allocateFromRegion(&this->stickyAccepts, sizeof(int));
+            if (accept == NULL)
+            {
+                return false;
+            }
+            *accept = node->requestIndex;
+            this->stickyAcceptCount++;
+        }
+    }
+
+    // Where the sticky nodes lead on each byte class, minus the sticky nodes themselves
+    int* stickyMoves = (int*)(this->work.base + this->work.used);
+    int stickyMovesLength = 0;
+    int c;
+    for (c = 0; c < this->classCount; ++c)
+    {
+        int seedCount = 0;
+        for (i = 0; i < nodeCount && this->hasSticky; ++i)
+        {
+            NfaNode* node = getNode(this, i);
+            if (sticky[i] && node->type == NODE_CHAR && isInSet(node->set, representative[c]))
+            {
+                seeds[seedCount++] = node->out1;
+            }
+        }
+        int length = computeClosure(this, seeds, seedCount, sticky, marks, ++generation, stack, members, closure);
+        if (allocateFromRegion(&this->work, length*sizeof(int)) == NULL)
+        {
+            return false;
+        }
+        memcpy(stickyMoves + stickyMovesLength, closure, length*sizeof(int));
+        stickyMoveOffsets[c] = stickyMovesLength;
+        stickyMovesLength += length;
+    }
+    stickyMoveOffsets[this->classCount] = stickyMovesLength;
+
+    // The dead state has no NFA states, so it goes in by hand. With sticky nodes, it is never reached.
+    DfaState* dead = (DfaState*)allocateFromRegion(&this->states, sizeof(DfaState));
+    if (dead == NULL)
+    {
+        return false;
+    }
+    memset(dead, 0, sizeof(DfaState));
+    this->stateCount = 1;
+
+    int startOwnLength = 0;
+    for (i = 0; i < startLength; ++i)
+    {
+        if (!sticky[start[i]])
+        {
+            start[startOwnLength++] = start[i];
+        }
+    }
+    if (findOrAddState(this, start, startOwnLength) != START_STATE)
+    {
+        return false;
+    }
+
+    int s;
+    for (s = START_STATE; s < this->stateCount; ++s)
+    {
+        unsigned int* row = (unsigned int*)allocateFromRegion(&this->transitions, this->classCount*sizeof(unsigned int));
+        if (row == NULL)
+        {
+            return false;
+        }
+        if (s == START_STATE)
+        {
+            // The dead state's row, all zero, comes first
+            row = (unsigned int*)allocateFromRegion(&this->transitions, this->classCount*sizeof(unsigned int));
+            if (row == NULL)
+            {
+                return false;
+            }
+        }
+
+        // Regions never move, so these stay valid while states are added
+        DfaState* state = getState(this, s);
+        int* set = getStateSet(this, state);
+        for (c = 0; c < this->classCount; ++c)
+        {
+            int seedCount = 0;
+            for (i = 0; i < state->setLength; ++i)
+            {
+                NfaNode* node = getNode(this, set[i]);
+                if (node->type == NODE_CHAR && isInSet(node->set, representative[c]))
+                {
+                    seeds[seedCount++] = node->out1;
+                }
+            }
+
+            int length = computeClosure(this, seeds, seedCount, sticky, marks, ++generation, stack, members, closure);
+            length = mergeSorted(closure, length, stickyMoves + stickyMoveOffsets[c],
+                stickyMoveOffsets[c + 1] - stickyMoveOffsets[c], merged);
+            int next = findOrAddState(this, merged, length);
+            if (next < 0)
+            {
+                // Too complex
+                return false;
+            }
+            row[c] = (unsigned int)next;
+        }
+    }
+    return true;
+}
+
+//private
+size_t getAcceptCount(PatternCompiler* this)
+{
+    // Every state but the dead one also accepts what the sticky nodes do
+    size_t count = (size_t)(this->stateCount - 1)*this->stickyAcceptCount;
+    int s;
+    for (s = 0; s < this->stateCount; ++s)
+    {
+        count += getState(this, s)->acceptCount;
+    }
+    return count;
+}
+
+size_t getPatternDFASize(PatternCompiler* this)
+{
+    if (this->patternCount == 0)
+    {
+        return 0;
+    }
+    return sizeof(PatternDFA) + (this->stateCount + 1)*sizeof(unsigned int) + getAcceptCount(this)*sizeof(int)
+        + (size_t)this->stateCount*this->classCount*sizeof(unsigned int);
+}
+
+void writePatternDFA(PatternCompiler* this, void* destination)
+{
+    PatternDFA* dfa = (PatternDFA*)destination;
+    dfa->stateCount = (unsigned int)this->stateCount;
+    dfa->classCount = (unsigned int)this->classCount;
+    dfa->acceptCount = (unsigned int)getAcceptCount(this);
+    memcpy(dfa->byteClass, this->byteClass, sizeof(this->byteClass));
+
+    unsigned int* acceptStart = (unsigned int*)(dfa + 1);
+    int* accepts = (int*)(acceptStart + this->stateCount + 1);
+    const int* stickyAccepts = (const int*)this->stickyAccepts.base;
+    unsigned int used = 0;
+    int s;
+    for (s = 0; s < this->stateCount; ++s)
+    {
+        acceptStart[s] = used;
+        DfaState* state = getState(this, s);
+        if (s == DEAD_STATE)
+        {
+            continue;
+        }
+
+        // Sticky nodes are never in a state set, so the two lists have nothing in common
+        const int* set = getStateSet(this, state);
+        int i = 0;
+        int j = 0;
+        int own = 0;
+        while (own < state->acceptCount || j < this->stickyAcceptCount)
+        {
+            while (getNode(this, set[i])->type != NODE_MATCH && own < state->acceptCount)
+            {
+                ++i;
+            }
+            int ownIndex = own < state->acceptCount ? getNode(this, set[i])->requestIndex : -1;
+            if (j == this->stickyAcceptCount || (own < state->acceptCount && ownIndex < stickyAccepts[j]))
+            {
+                accepts[used++] = ownIndex;
+                ++own;
+                ++i;
+            }
+            else
+            {
+                accepts[used++] = stickyAccepts[j++];
+            }
+        }
+    }
+    acceptStart[this->stateCount] = used;
+    memcpy(accepts + used, this->transitions.base, (size_t)this->stateCount*this->classCount*sizeof(unsigned int));
+}
+
+// The requests whose pattern matches the whole name, in config order. *count is 0 if there are none.
+const int* matchPatternDFA(const void* dfa, const char* name, int* count)
+{
+    const PatternDFA* header = (const PatternDFA*)dfa;
+    const unsigned int* acceptStart = (const unsigned int*)(header + 1);
+    const int* accepts = (const int*)(acceptStart + header->stateCount + 1);
+    const unsigned int* transitions = (const unsigned int*)(accepts + header->acceptCount);
+    unsigned int state = START_STATE;
+    *count = 0;
+    while (*name != '\0')
+    {
+        state = transitions[state*header->classCount + header->byteClass[(unsigned char)*name++]];
+        if (state == DEAD_STATE)
+        {
+            return NULL;
+        }
+    }
+    *count = (int)(acceptStart[state + 1] - acceptStart[state]);
+    return accepts + acceptStart[state];
+}
@@ -0,0 +1,60 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __PATTERN_COMPILER_H__
+#define __PATTERN_COMPILER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Scratch memory of one growing array. Reserved up front, so nothing ever moves.
+typedef struct
+{
+	char* base;
+	size_t used;
+	size_t reserved;
+} ScratchRegion;
+
+// Turns all the glob and regex rules of a config into one DFA, so that matching a name costs the same
+// no matter how many patterns there are. Runs on the config compiler thread, so it never uses malloc.
+typedef struct
+{
+	ScratchRegion nodes;
+	ScratchRegion stateSets;
+	ScratchRegion states;
+	ScratchRegion stateHash;
+	ScratchRegion transitions;
+	ScratchRegion work;
+	ScratchRegion stickyAccepts;
+	int start;
+	int patternCount;
+	unsigned char byteClass[256];
+	int classCount;
+	int stateCount;
+	// See buildPatternDFA
+	bool hasSticky;
+	int stickyAcceptCount;
+} PatternCompiler;
+
+bool initPatternCompiler(PatternCompiler* this);
+void destroyPatternCompiler(PatternCompiler* this);
+bool addGlobPattern(PatternCompiler* this, const char* pattern, int length, int requestIndex);
+bool addRegexPattern(PatternCompiler* this, const char* pattern, int length, int requestIndex);
+bool buildPatternDFA(PatternCompiler* this);
+size_t getPatternDFASize(PatternCompiler* this);
+void writePatternDFA(PatternCompiler* this, void* destination);
+const int* matchPatternDFA(const void* dfa, const char* name, int* count);
+#endif
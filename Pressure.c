@@ -0,0 +1,170 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Pressure.h"
+#include "CgroupBackend.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "memwatch.h"
+
+const char* PSI_ENV_VAR = "PROCNANNYPSI";
+const char* PSI_SCORE_ENV_VAR = "PROCNANNYPSISCORE";
+
+// With PROCNANNYPSI set to a trigger in the kernel's own syntax ("some 150000 1000000": tasks stalled on memory
+// for 150 ms in total within any 1 s window), the trigger is registered on the memory pressure of the monitored
+// processes: the memory.pressure of the cgroup subtree with the cgroup backend, or else /proc/pressure/memory for
+// the whole host (Linux 4.20 with CONFIG_PSI). The kernel raises POLLPRI on the file when the threshold is
+// crossed, at most once per window, and the event loop polls it along with everything else, so a spike is acted on
+// as it happens rather than at the next refresh. See relievePressure for what is done about it.
+
+#define SYSTEM_MEMORY_PRESSURE "/proc/pressure/memory"
+#define DEFAULT_PRESSURE_SCORE "priority,rss,age"
+#define MAX_SCORE_LENGTH 64
+// How many times a failed trigger is registered again before it is given up on
+#define MAX_TRIGGER_RESTARTS 3
+
+static int pressureFD = -1;
+static ScoreKey score[MAX_SCORE_KEYS + 1];
+static bool isScoreRead = false;
+static int restarts = 0;
+
+// True if PROCNANNYPSI is set, and its trigger could be registered
+bool startPressureTrigger()
+{
+    const char* trigger = getenv(PSI_ENV_VAR);
+    if (trigger == NULL || trigger[0] == '\0' || pressureFD >= 0)
+    {
+        return pressureFD >= 0;
+    }
+
+    char path[MAX_CGROUP_PATH + 32];
+    const char* subtree = getCgroupSubtree();
+    if (subtree != NULL)
+    {
+        snprintf(path, sizeof(path), "%s/memory.pressure", subtree);
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "%s", SYSTEM_MEMORY_PRESSURE);
+    }
+    LogReport report;
+    pressureFD = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    int length = strlen(trigger) + 1;
+    // With its NUL, which the kernel wants. A trigger lasts as long as the file stays open.
+    if (pressureFD < 0 || write(pressureFD, trigger, length) != length)
+    {
+        stopPressureTrigger();
+        report.message = "Memory pressure can't be watched: PSI is not available, or PROCNANNYPSI is not a valid "
+            "trigger.";
+        report.type = WARNING;
+        saveLogReport(report);
+        return false;
+    }
+    report.message = "Watching memory pressure.";
+    report.type = INFO;
+    saveLogReport(report);
+    return true;
+}
+
+// For when the trigger's file has POLLERR (as when the cgroup it is on goes away) or POLLNVAL instead of POLLPRI:
+// closes it and registers the trigger again, up to MAX_TRIGGER_RESTARTS times. False if pressure is no longer
+// watched.
+bool restartPressureTrigger()
+{
+    stopPressureTrigger();
+    LogReport report;
+    if (++restarts > MAX_TRIGGER_RESTARTS)
+    {
+        report.message = "The memory pressure trigger keeps failing. Memory pressure is no longer watched.";
+        report.type = ERROR;
+        saveLogReport(report);
+        return false;
+    }
+    report.message = "The memory pressure trigger failed. Registering it again.";
+    report.type = WARNING;
+    saveLogReport(report);
+    return startPressureTrigger();
+}
+
+// Has POLLPRI when the trigger fires. -1 if there is none.
+int getPressureFD()
+{
+    return pressureFD;
+}
+
+//private
+ScoreKey parseScoreKey(const char* name)
+{
+    if (strcmp(name, "priority") == 0)
+    {
+        return SCORE_PRIORITY;
+    }
+    if (strcmp(name, "rss") == 0)
+    {
+        return SCORE_RSS;
+    }
+    return strcmp(name, "age") == 0 ? SCORE_AGE : SCORE_END;
+}
+
+//private
+int parseScore(const char* text)
+{
+    char copy[MAX_SCORE_LENGTH];
+    snprintf(copy, sizeof(copy), "%s", text);
+    int count = 0;
+    char* name = strtok(copy, ",");
+    while (name != NULL && count < MAX_SCORE_KEYS)
+    {
+        ScoreKey key = parseScoreKey(name);
+        if (key != SCORE_END)
+        {
+            score[count++] = key;
+        }
+        name = strtok(NULL, ",");
+    }
+    score[count] = SCORE_END;
+    return count;
+}
+
+// The keys from PROCNANNYPSISCORE, most significant first, up to SCORE_END: "priority" (lowest first), "rss"
+// (largest first) and "age" (youngest first, having lost the least work). Unknown keys are skipped, and
+// DEFAULT_PRESSURE_SCORE stands in if none are left.
+const ScoreKey* getPressureScore()
+{
+    if (!isScoreRead)
+    {
+        const char* text = getenv(PSI_SCORE_ENV_VAR);
+        if (text == NULL || parseScore(text) == 0)
+        {
+            parseScore(DEFAULT_PRESSURE_SCORE);
+        }
+        isScoreRead = true;
+    }
+    return score;
+}
+
+void stopPressureTrigger()
+{
+    if (pressureFD >= 0)
+    {
+        close(pressureFD);
+        pressureFD = -1;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __PRESSURE_H__
+#define __PRESSURE_H__
+
+#include <stdbool.h>
+
+// What victims under memory pressure are ordered by, in PROCNANNYPSISCORE
+typedef enum { SCORE_END, SCORE_PRIORITY, SCORE_RSS, SCORE_AGE } ScoreKey;
+#define MAX_SCORE_KEYS 3
+
+bool startPressureTrigger();
+bool restartPressureTrigger();
+int getPressureFD();
+const ScoreKey* getPressureScore();
+void stopPressureTrigger();
+#endif
\ No newline at end of file
@@ -0,0 +1,338 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ProcUring.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/stat.h>
+#include <linux/io_uring.h>
+#include "memwatch.h"
+
+const char* IO_URING_ENV_VAR = "PROCNANNYIOURING";
+
+// Every process takes a chain of four operations: statx on /proc/<pid>, openat of its comm into a registered
+// file slot, a read from that slot and a close of it. The chains are hard linked, so each step runs after the
+// one before even if that one failed, and the close always frees the slot for the next batch. A whole batch
+// goes to the kernel, and is waited for, with a single io_uring_enter.
+//
+// Everything the kernel reads or writes is in the buffers here, so a batch that goes wrong halfway can't
+// leave it writing to memory the caller has moved on from.
+
+#define OPS_PER_PROCESS 4
+#define STATX_OP 0
+#define OPEN_OP 1
+#define READ_OP 2
+#define CLOSE_OP 3
+#define RING_ENTRIES (PROC_BATCH_SIZE*OPS_PER_PROCESS)
+
+static bool isTried = false;
+static int ringFD = -1;
+
+static void* sqRing = MAP_FAILED;
+static size_t sqRingSize = 0;
+static void* cqRing = MAP_FAILED;
+static size_t cqRingSize = 0;
+static struct io_uring_sqe* sqes = (struct io_uring_sqe*)MAP_FAILED;
+static size_t sqesSize = 0;
+
+static unsigned int* sqHead;
+static unsigned int* sqTail;
+static unsigned int* sqMask;
+static unsigned int* sqArray;
+static unsigned int* cqHead;
+static unsigned int* cqTail;
+static unsigned int* cqMask;
+static struct io_uring_cqe* cqes;
+
+static char pidNames[PROC_BATCH_SIZE][16];
+static char commPaths[PROC_BATCH_SIZE][32];
+static struct statx owners[PROC_BATCH_SIZE];
+static char comms[PROC_BATCH_SIZE][32];
+static int ownerResults[PROC_BATCH_SIZE];
+static int readResults[PROC_BATCH_SIZE];
+
+//private
+bool isIoUringEnabled()
+{
+    const char* enabled = getenv(IO_URING_ENV_VAR);
+    return enabled != NULL && compareStrings(enabled, "1");
+}
+
+//private
+int enterRing(unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ringFD, toSubmit, minComplete, flags, NULL, 0);
+}
+
+//private
+// Whether the kernel knows every operation a batch uses
+bool areRingOpsSupported()
+{
+    size_t size = sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, size);
+    LogReport report;
+    if (!checkMallocResult(probe, &report))
+    {
+        saveLogReport(report);
+        return false;
+    }
+
+    bool supported = syscall(__NR_io_uring_register, ringFD, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    const int ops[] = { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    unsigned int i;
+    for (i = 0; supported && i < sizeof(ops)/sizeof(ops[0]); ++i)
+    {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+//private
+bool mapRing(const struct io_uring_params* params)
+{
+    sqRingSize = params->sq_off.array + params->sq_entries*sizeof(unsigned int);
+    cqRingSize = params->cq_off.cqes + params->cq_entries*sizeof(struct io_uring_cqe);
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (cqRingSize > sqRingSize)
+        {
+            sqRingSize = cqRingSize;
+        }
+    }
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+    {
+        return false;
+    }
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cqRing = sqRing;
+        cqRingSize = 0;
+    }
+    else
+    {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    sqesSize = params->sq_entries*sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD,
+        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    sqHead = (unsigned int*)((char*)sqRing + params->sq_off.head);
+    sqTail = (unsigned int*)((char*)sqRing + params->sq_off.tail);
+    sqMask = (unsigned int*)((char*)sqRing + params->sq_off.ring_mask);
+    sqArray = (unsigned int*)((char*)sqRing + params->sq_off.array);
+    cqHead = (unsigned int*)((char*)cqRing + params->cq_off.head);
+    cqTail = (unsigned int*)((char*)cqRing + params->cq_off.tail);
+    cqMask = (unsigned int*)((char*)cqRing + params->cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)((char*)cqRing + params->cq_off.cqes);
+    return true;
+}
+
+// Sets up the ring the first time it is called, if PROCNANNYIOURING=1. False if /proc is to be read with
+// plain syscalls instead: io_uring isn't enabled, or this kernel (or a seccomp filter) doesn't allow it.
+bool startProcUring()
+{
+    if (isTried)
+    {
+        return ringFD >= 0;
+    }
+    isTried = true;
+    if (!isIoUringEnabled())
+    {
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFD = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    bool started = ringFD >= 0 && mapRing(&params) && areRingOpsSupported();
+    if (started)
+    {
+        int slots[PROC_BATCH_SIZE];
+        int i;
+        for (i = 0; i < PROC_BATCH_SIZE; ++i)
+        {
+            slots[i] = -1;
+        }
+        started = syscall(__NR_io_uring_register, ringFD, IORING_REGISTER_FILES, slots, PROC_BATCH_SIZE) >= 0;
+    }
+
+    LogReport report;
+    report.type = INFO;
+    if (!started)
+    {
+        stopProcUring();
+        report.message = "io_uring is not available. Reading /proc with plain syscalls.";
+        saveLogReport(report);
+        return false;
+    }
+    report.message = "Reading /proc through io_uring.";
+    saveLogReport(report);
+    return true;
+}
+
+//private
+void queueOp(unsigned int* tail, unsigned char opcode, int fd, const void* address, unsigned int length, int process,
+    int op)
+{
+    unsigned int index = *tail & *sqMask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(unsigned long)address;
+    sqe->len = length;
+    sqe->user_data = (unsigned long long)(process*OPS_PER_PROCESS + op);
+    if (op != CLOSE_OP)
+    {
+        sqe->flags = IOSQE_IO_HARDLINK;
+    }
+    sqArray[index] = index;
+    ++*tail;
+}
+
+// Stage one of a /proc scan for up to PROC_BATCH_SIZE processes at once, relative to the open /proc. False if
+// the batch couldn't be read this way; the ring is then stopped, and reads has to be filled in some other way.
+bool readProcBatch(int procFD, ProcRead* reads, int count)
+{
+    unsigned int tail = *sqTail;
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        strncpy(pidNames[i], reads[i].pidName, sizeof(pidNames[i]) - 1);
+        pidNames[i][sizeof(pidNames[i]) - 1] = '\0';
+        snprintf(commPaths[i], sizeof(commPaths[i]), "%s/comm", pidNames[i]);
+        ownerResults[i] = -1;
+        readResults[i] = -1;
+
+        queueOp(&tail, IORING_OP_STATX, procFD, pidNames[i], STATX_UID, i, STATX_OP);
+        sqes[(tail - 1) & *sqMask].off = (unsigned long long)(unsigned long)&owners[i];
+        queueOp(&tail, IORING_OP_OPENAT, procFD, commPaths[i], 0, i, OPEN_OP);
+        sqes[(tail - 1) & *sqMask].open_flags = O_RDONLY;
+        sqes[(tail - 1) & *sqMask].file_index = (unsigned int)i + 1;
+        queueOp(&tail, IORING_OP_READ, i, comms[i], sizeof(comms[i]) - 1, i, READ_OP);
+        sqes[(tail - 1) & *sqMask].flags |= IOSQE_FIXED_FILE;
+        queueOp(&tail, IORING_OP_CLOSE, 0, NULL, 0, i, CLOSE_OP);
+        sqes[(tail - 1) & *sqMask].file_index = (unsigned int)i + 1;
+    }
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+    unsigned int queued = (unsigned int)count*OPS_PER_PROCESS;
+    unsigned int completed = 0;
+    bool isSupported = true;
+    bool isFailed = false;
+    while (completed < queued)
+    {
+        unsigned int unsubmitted = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (enterRing(unsubmitted, queued - completed, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            // Whatever was submitted still completes into the buffers here, and the next batch would trip
+            // over it, so this ring is done
+            isFailed = true;
+            break;
+        }
+
+        unsigned int head = *cqHead;
+        unsigned int cqTailNow = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != cqTailNow; ++head, ++completed)
+        {
+            struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+            int process = (int)(cqe->user_data/OPS_PER_PROCESS);
+            switch (cqe->user_data % OPS_PER_PROCESS)
+            {
+                case STATX_OP:
+                    ownerResults[process] = cqe->res;
+                    break;
+
+                case OPEN_OP:
+                    // Kernels before 5.15 can't open into a file slot
+                    isSupported = isSupported && cqe->res != -EINVAL;
+                    break;
+
+                case READ_OP:
+                    readResults[process] = cqe->res;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    if (isFailed || !isSupported)
+    {
+        LogReport report;
+        report.message = "Reading /proc through io_uring failed. Falling back to plain syscalls.";
+        report.type = WARNING;
+        saveLogReport(report);
+        stopProcUring();
+        return false;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        reads[i].length = -1;
+        if (ownerResults[i] >= 0 && readResults[i] >= 0)
+        {
+            reads[i].uid = owners[i].stx_uid;
+            memcpy(reads[i].comm, comms[i], readResults[i]);
+            reads[i].comm[readResults[i]] = '\0';
+            reads[i].length = readResults[i];
+        }
+    }
+    return true;
+}
+
+void stopProcUring()
+{
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqesSize);
+        sqes = (struct io_uring_sqe*)MAP_FAILED;
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+    {
+        munmap(cqRing, cqRingSize);
+    }
+    cqRing = MAP_FAILED;
+    if (sqRing != MAP_FAILED)
+    {
+        munmap(sqRing, sqRingSize);
+        sqRing = MAP_FAILED;
+    }
+    if (ringFD >= 0)
+    {
+        close(ringFD);
+        ringFD = -1;
+    }
+}
\ No newline at end of file
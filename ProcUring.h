@@ -0,0 +1,38 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __PROC_URING_H__
+#define __PROC_URING_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+#define PROC_BATCH_SIZE 64
+
+// What stage one of a /proc scan reads for one process: the owner of /proc/<pid> and its comm
+typedef struct
+{
+	char pidName[16];
+	// Filled in by readProcBatch. length is -1 if the process is gone.
+	uid_t uid;
+	char comm[32];
+	int length;
+} ProcRead;
+
+bool startProcUring();
+bool readProcBatch(int procFD, ProcRead* reads, int count);
+void stopProcUring();
+#endif
\ No newline at end of file
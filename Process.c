@@ -18,12 +18,62 @@ limitations under the License.
 #include "Logging.h"
 #include "Utils.h"
 #include "ProgramIO.h"
+#include "ProcessCache.h"
+#include "StatFiles.h"
+#include "ProcUring.h"
+#include "Taskstats.h"
 #include <string.h>
 #include <signal.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include "memwatch.h"
 
-// Constructor of a Process struct from a processString (output line from the ps command)
-Process* processConstructor(char* processString)
+#define STARTING_PROCESS_CAPACITY 256
+#define STARTING_COMMAND_SIZE 256
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef SYS_process_madvise
+#define SYS_process_madvise 440
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+// Mappings per process_madvise call, well under the kernel's UIO_MAXIOV
+#define MAX_PAGEOUT_RANGES 256
+// What a throttled process is lowered to: the lowest CPU priority, and the idle I/O class (from linux/ioprio.h,
+// which glibc doesn't wrap)
+#define THROTTLE_NICE 19
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_IDLE (3 << 13)
+
+const char* PREFILTER_ENV_VAR = "PROCNANNYPREFILTER";
+
+typedef struct
+{
+	Process** processes;
+	int count;
+	int capacity;
+} ProcessList;
+
+// A process found while scanning /proc. Only the pid and comm are known up front; everything else is read
+// on demand, so that processes no rule can match cost nothing more than their comm.
+Process* processConstructor(pid_t pid, const char* comm)
 {
     Process* this = (Process*)malloc(sizeof(Process));
     LogReport report;
@@ -33,39 +83,9 @@ Process* processConstructor(char* processString)
         return (Process*)NULL;
     }
 
-    this->user = getNextStrTokString(processString);
-    this->pid = atoi(strtok(NULL, " "));
-    this->cpu = atof(strtok(NULL, " "));
-    this->mem = atof(strtok(NULL, " "));
-    this->vsz = atoi(strtok(NULL, " "));
-    this->rss = atoi(strtok(NULL, " "));
-    this->tty = getNextStrTokString(NULL);
-    this->stat = getNextStrTokString(NULL);
-    this->start = getNextStrTokString(NULL);
-    this->time = getNextStrTokString(NULL);
-
-    this->command = (char*)malloc(sizeof(char));
-    *this->command = '\0';
-
-    char* commandPart;
-    while ((commandPart = strtok(NULL, " ")) != NULL)
-    {
-        char* spaceAdded;
-        if (*this->command == '\0')
-        {
-            spaceAdded = this->command;
-        }
-        else
-        {
-            spaceAdded = stringJoin(this->command, " ");
-            free(this->command);
-        }
-
-        char* newJoin = stringJoin(spaceAdded, commandPart);
-        free(spaceAdded);
-
-        this->command = newJoin;
-    }
+    memset(this, 0, sizeof(Process));
+    this->pid = pid;
+    strncpy(this->comm, comm, sizeof(this->comm) - 1);
     return this;
 }
 
@@ -76,12 +96,8 @@ void processDestructor(Process* this)
     {
         return;
     }
-    free(this->user);
-    free(this->tty);
-    free(this->stat);
-    free(this->start);
-    free(this->time);
     free(this->command);
+    free(this->parentName);
     free(this);
 }
 
@@ -106,84 +122,812 @@ bool killProcess(Process process)
     return (bool)(result == 0);
 }
 
-Process** searchRunningProcesses(int* processesFound, const char* processName, bool ignoreCmdOptions)
+// A pidfd for the process, which keeps referring to it after its pid is reused, and becomes readable when it
+// exits. -1 if it is gone, or if the kernel has no pidfds (before 5.3).
+int openProcessFD(pid_t pid)
 {
-    int i = 0;
-    LogReport report;
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+// Through the pidfd if there is one, so that it can't hit a process that took over the pid
+bool signalProcess(pid_t pid, int pidFD, int signal)
+{
+    if (pidFD >= 0)
+    {
+        return syscall(SYS_pidfd_send_signal, pidFD, signal, NULL, 0) == 0;
+    }
+    return kill(pid, signal) == 0;
+}
+
+// Waits up to timeoutMillis for the process to exit. True if it has. Without a pidfd, this can only look
+// once the time is up.
+bool waitForProcessExit(pid_t pid, int pidFD, int timeoutMillis)
+{
+    struct pollfd exitFD;
+    exitFD.fd = pidFD;
+    exitFD.events = POLLIN;
+    long long deadline = getMonotonicMillis() + timeoutMillis;
+    long long remaining = timeoutMillis;
+    do
+    {
+        if (poll(&exitFD, 1, (int)remaining) > 0)
+        {
+            return true;
+        }
+    }
+    while ((remaining = deadline - getMonotonicMillis()) > 0);
+    return pidFD < 0 && kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+//private
+bool isPrefilterEnabled()
+{
+    const char* prefilter = getenv(PREFILTER_ENV_VAR);
+    return prefilter == NULL || !compareStrings(prefilter, "0");
+}
+
+//private
+// Reads <pid>/<name> relative to the open /proc into buffer, NUL terminated. Returns the length, or -1.
+int readProcFileAt(int procFD, const char* pidName, const char* name, char* buffer, int size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s", pidName, name);
+    int fd = openat(procFD, path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int length = (int)read(fd, buffer, size - 1);
+    close(fd);
+    if (length < 0)
+    {
+        return -1;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+// True if the name of an entry in /proc (or in a task directory) is all digits
+bool isPidName(const char* name)
+{
+    if (*name == '\0')
+    {
+        return false;
+    }
+    for (; *name != '\0'; ++name)
+    {
+        if (*name < '0' || *name > '9')
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-    char* command = stringJoin("ps -u | grep ", processName);
-    char** lines = getOutputFromProgram(command, &i, &report);
-    free(command);
+//private
+// Stage one for a batch of processes, one at a time
+void readProcBatchDirectly(int procFD, ProcRead* reads, int count)
+{
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        struct stat info;
+        reads[i].length = -1;
+        if (fstatat(procFD, reads[i].pidName, &info, 0) == 0)
+        {
+            reads[i].uid = info.st_uid;
+            reads[i].length = readProcFileAt(procFD, reads[i].pidName, "comm", reads[i].comm, sizeof(reads[i].comm));
+        }
+    }
+}
 
-    if (lines == NULL)
+//private
+// Stage two happens in getProcessCommand and friends, when matching asks for more
+bool addScannedProcesses(ProcessList* list, ProcRead* reads, int count, ProcessFilter isCandidate, const void* context)
+{
+    uid_t self = geteuid();
+    int i;
+    for (i = 0; i < count; ++i)
     {
-        // LogReport has been filled with some error
+        ProcRead* read = &reads[i];
+        if (read->length <= 0 || (self != 0 && read->uid != self))
+        {
+            continue;
+        }
+        if (read->comm[read->length - 1] == '\n')
+        {
+            read->comm[read->length - 1] = '\0';
+        }
+        if (isCandidate != NULL && !isCandidate(read->comm, context))
+        {
+            continue;
+        }
+
+        LogReport report;
+        if (list->count == list->capacity)
+        {
+            list->capacity *= 2;
+            Process** grown = (Process**)realloc(list->processes, sizeof(Process*)*list->capacity);
+            if (!checkMallocResult(grown, &report))
+            {
+                saveLogReport(report);
+                return false;
+            }
+            list->processes = grown;
+        }
+
+        Process* p = processConstructor((pid_t)atoi(read->pidName), read->comm);
+        if (p == NULL)
+        {
+            return false;
+        }
+        p->uid = read->uid;
+        p->isUidRead = true;
+        list->processes[list->count++] = p;
+    }
+    return true;
+}
+
+// A snapshot of the processes in the user's space (every process, for root), straight from /proc.
+// isCandidate sees each process's comm first, and only the processes it accepts are returned (all of them if
+// it is NULL, or if PROCNANNYPREFILTER=0). Their other fields are read on demand.
+//
+// Stage one (the owner and the comm) is done for PROC_BATCH_SIZE processes at a time, through io_uring if
+// startProcUring says so.
+Process** getRunningProcesses(int* processesFound, ProcessFilter isCandidate, const void* context)
+{
+    LogReport report;
+    advanceProcessCache();
+    if (!isPrefilterEnabled())
+    {
+        isCandidate = NULL;
+    }
+    bool isUringUsed = startProcUring();
+
+    DIR* proc = opendir("/proc");
+    if (proc == NULL)
+    {
+        report.message = "Failed to open /proc.";
+        report.type = ERROR;
         saveLogReport(report);
         *processesFound = -1;
         return (Process**)NULL;
     }
 
-    if (i <= 2)
+    ProcessList list;
+    list.count = 0;
+    list.capacity = STARTING_PROCESS_CAPACITY;
+    list.processes = (Process**)malloc(sizeof(Process*)*list.capacity);
+    if (!checkMallocResult(list.processes, &report))
     {
-        // Nothing's found. 2 because 2 internal processes are started
-        freeOutputFromProgram(lines, i);
-        *processesFound = 0;
+        saveLogReport(report);
+        closedir(proc);
+        *processesFound = -1;
         return (Process**)NULL;
     }
 
-    // i  > 2
-    Process** processes = (Process**)malloc(sizeof(Process*)*(i-2));
-    if (!checkMallocResult(processes, &report))
+    int procFD = dirfd(proc);
+    ProcRead reads[PROC_BATCH_SIZE];
+    int batched = 0;
+    bool isEnd = false;
+    while (!isEnd)
+    {
+        struct dirent* entry = readdir(proc);
+        isEnd = entry == NULL;
+        if (!isEnd && isPidName(entry->d_name))
+        {
+            strncpy(reads[batched].pidName, entry->d_name, sizeof(reads[batched].pidName) - 1);
+            reads[batched].pidName[sizeof(reads[batched].pidName) - 1] = '\0';
+            ++batched;
+        }
+        if (batched == 0 || (batched < PROC_BATCH_SIZE && !isEnd))
+        {
+            continue;
+        }
+
+        if (!isUringUsed || !readProcBatch(procFD, reads, batched))
+        {
+            isUringUsed = false;
+            readProcBatchDirectly(procFD, reads, batched);
+        }
+        if (!addScannedProcesses(&list, reads, batched, isCandidate, context))
+        {
+            destroyProcessArray(list.processes, list.count);
+            closedir(proc);
+            *processesFound = -1;
+            return (Process**)NULL;
+        }
+        batched = 0;
+    }
+
+    closedir(proc);
+    *processesFound = list.count;
+    return list.processes;
+}
+
+//private
+bool hasCommOf(const char* comm, const void* context)
+{
+    return isCommOf(comm, (const char*)context);
+}
+
+// The processes whose command is processName, or whose first word is, if ignoreCmdOptions
+Process** searchRunningProcesses(int* processesFound, const char* processName, bool ignoreCmdOptions)
+{
+    int num = 0;
+    Process** processes = getRunningProcesses(&num, hasCommOf, processName);
+    if (processes == NULL)
     {
-        saveLogReport(report);
-        freeOutputFromProgram(lines, i);
         *processesFound = -1;
         return (Process**)NULL;
     }
 
     int source;
     int destination = 0;
-
-    for (source = 0; source < i; ++source)
+    for (source = 0; source < num; ++source)
     {
-        Process* p = processConstructor(lines[source]);
-        if (p == NULL)
+        Process* p = processes[source];
+        const char* command = getProcessCommand(p);
+        bool matches = false;
+        if (command != NULL)
         {
-            freeOutputFromProgram(lines, i);
-            *processesFound = -1;
-            return (Process**)NULL;
+            size_t nameLength = strlen(processName);
+            matches = compareStrings(command, processName)
+                || (ignoreCmdOptions && strncmp(command, processName, nameLength) == 0 && command[nameLength] == ' ');
         }
-        if (compareStrings(p->command, processName))
+
+        if (matches)
         {
             processes[destination++] = p;
         }
-        else if (ignoreCmdOptions)
-        {
-            char* temp = copyString(p->command);
-            char* part = strtok(temp, " ");
-            if (compareStrings(part, processName))
-            {
-                processes[destination++] = p;
-            }
-            else
-            {
-                processDestructor(p);
-            }
-            free(temp);
-        }
         else
         {
             processDestructor(p);
         }
     }
 
-    freeOutputFromProgram(lines, i);
-
     *processesFound = destination;
     if (destination == 0)
     {
-        destroyProcessArray(processes, destination);
+        free(processes);
         processes = NULL;
     }
     return processes;
+}
+
+// What the comm of a process running name (a command, or just its first word) would be: the kernel sets it
+// to the first MAX_COMM_LENGTH characters of the last path component of the executable. The '-' that login
+// shells put in front of their argv[0] isn't in the executable's name, so it is skipped.
+const char* getCommKey(const char* name, int* length)
+{
+    const char* end = strchr(name, ' ');
+    if (end == NULL)
+    {
+        end = name + strlen(name);
+    }
+    const char* base = name;
+    const char* slash;
+    while ((slash = (const char*)memchr(base, '/', end - base)) != NULL)
+    {
+        base = slash + 1;
+    }
+    if (*base == '-' && end - base > 1)
+    {
+        ++base;
+    }
+    *length = end - base < MAX_COMM_LENGTH ? (int)(end - base) : MAX_COMM_LENGTH;
+    return base;
+}
+
+bool isCommOf(const char* comm, const char* name)
+{
+    int length;
+    const char* key = getCommKey(name, &length);
+    return (int)strlen(comm) == length && memcmp(comm, key, length) == 0;
+}
+
+// A Process with only a pid and command, for looking up a process that is not in a snapshot. The other
+// fields are read on demand like for any other Process; clearProcessQuery releases them.
+void initProcessQuery(Process* this, pid_t pid, char* command)
+{
+    memset(this, 0, sizeof(Process));
+    this->pid = pid;
+    this->command = command;
+    this->isCommandRead = true;
+}
+
+void clearProcessQuery(Process* this)
+{
+    free(this->parentName);
+    this->parentName = (char*)NULL;
+    this->isParentNameRead = false;
+}
+
+// Reads /proc/<pid>/<name> into buffer, NUL terminated. Returns the length, or -1.
+int readProcFile(pid_t pid, const char* name, char* buffer, int size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int length = (int)read(fd, buffer, size - 1);
+    close(fd);
+    if (length < 0)
+    {
+        return -1;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+// Its arguments joined by spaces, like ps shows them, or NULL if the process is gone
+const char* getProcessCommand(Process* this)
+{
+    if (this->isCommandRead)
+    {
+        return this->command;
+    }
+    this->isCommandRead = true;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/cmdline", (int)this->pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    LogReport report;
+    size_t size = STARTING_COMMAND_SIZE;
+    size_t length = 0;
+    char* command = (char*)malloc(size);
+    while (checkMallocResult(command, &report))
+    {
+        ssize_t result = read(fd, command + length, size - length - 1);
+        if (result <= 0)
+        {
+            break;
+        }
+        length += result;
+        if (length == size - 1)
+        {
+            size *= 2;
+            command = (char*)realloc(command, size);
+        }
+    }
+    close(fd);
+    if (command == NULL)
+    {
+        saveLogReport(report);
+        return NULL;
+    }
+
+    // Arguments are NUL separated, and the last one NUL terminated
+    while (length > 0 && command[length - 1] == '\0')
+    {
+        --length;
+    }
+    size_t i;
+    for (i = 0; i < length; ++i)
+    {
+        if (command[i] == '\0')
+        {
+            command[i] = ' ';
+        }
+    }
+    command[length] = '\0';
+
+    if (length == 0)
+    {
+        // Kernel threads and zombies
+        free(command);
+        char* bracketed = stringJoin("[", this->comm);
+        command = stringJoin(bracketed, "]");
+        free(bracketed);
+    }
+    this->command = command;
+    return this->command;
+}
+
+// The owner of /proc/<pid>, which is the process's effective uid. False if the process is gone.
+bool getProcessUid(Process* this, uid_t* uid)
+{
+    if (!this->isUidRead)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d", (int)this->pid);
+        struct stat info;
+        if (stat(path, &info) < 0)
+        {
+            return false;
+        }
+        this->uid = info.st_uid;
+        this->isUidRead = true;
+    }
+    *uid = this->uid;
+    return true;
+}
+
+//private
+// The ppid, start time, CPU time and sizes, from /proc/<pid>/stat. False if the process is gone.
+bool readProcessStat(Process* this)
+{
+    if (this->isStatRead)
+    {
+        return true;
+    }
+
+    // Fields are counted from after the comm, which is in parentheses and may itself hold anything
+    char statLine[1024];
+    if (readStatFile(this->pid, statLine, sizeof(statLine)) < 0)
+    {
+        return false;
+    }
+    char* commEnd = strrchr(statLine, ')');
+    int ppid;
+    unsigned long long userTicks;
+    unsigned long long systemTicks;
+    unsigned long vsize;
+    long rssPages;
+    if (commEnd == NULL
+        || sscanf(commEnd + 1, " %*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu %lu %ld",
+            &ppid, &userTicks, &systemTicks, &this->startTime, &vsize, &rssPages) != 6)
+    {
+        return false;
+    }
+    this->ppid = (pid_t)ppid;
+    this->statCpuTime = (userTicks + systemTicks)*1000000ull/sysconf(_SC_CLK_TCK);
+    this->statVsz = vsize/1024;
+    this->statRss = (unsigned long)rssPages*(sysconf(_SC_PAGESIZE)/1024);
+    this->isStatRead = true;
+    return true;
+}
+
+// Its start time, in clock ticks since boot. Together with the pid it identifies a process. False if the
+// process is gone.
+bool getProcessStartTime(Process* this, unsigned long long* startTime)
+{
+    if (!readProcessStat(this))
+    {
+        return false;
+    }
+    *startTime = this->startTime;
+    return true;
+}
+
+// Microseconds since boot, the clock start times in /proc are on
+unsigned long long getBootMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (unsigned long long)now.tv_sec*1000000 + now.tv_nsec/1000;
+}
+
+//private
+// Physical memory, in KiB
+unsigned long long getTotalMemory()
+{
+    static unsigned long long total = 0;
+    if (total == 0)
+    {
+        struct sysinfo info;
+        if (sysinfo(&info) < 0 || info.totalram == 0)
+        {
+            return 1;
+        }
+        total = (unsigned long long)info.totalram*info.mem_unit/1024;
+    }
+    return total;
+}
+
+//private
+// The current virtual and resident sizes in KiB, from /proc/<pid>/statm. False if the process is gone.
+bool readProcessStatm(pid_t pid, unsigned long* vsz, unsigned long* rss)
+{
+    char statm[128];
+    unsigned long sizePages;
+    unsigned long residentPages;
+    if (readProcFile(pid, "statm", statm, sizeof(statm)) < 0
+        || sscanf(statm, "%lu %lu", &sizePages, &residentPages) != 2)
+    {
+        return false;
+    }
+    unsigned long pageKiB = sysconf(_SC_PAGESIZE)/1024;
+    *vsz = sizePages*pageKiB;
+    *rss = residentPages*pageKiB;
+    return true;
+}
+
+// Fills in cpu, mem, vsz, rss, cpuTime and, with taskstats, peakVsz and peakRss. False if the process is gone.
+// The CPU time comes from taskstats if startTaskstats says so, and from /proc/<pid>/stat otherwise. vsz and rss
+// are always the current sizes: taskstats only has the high-water marks, so the sizes come from
+// /proc/<pid>/statm alongside it.
+bool getProcessUsage(Process* this)
+{
+    if (this->isUsageRead)
+    {
+        return true;
+    }
+
+    unsigned long long elapsed;
+    TaskUsage usage;
+    if (startTaskstats())
+    {
+        if (!getTaskUsage(this->pid, &usage))
+        {
+            return false;
+        }
+        if (!readProcessStatm(this->pid, &this->vsz, &this->rss))
+        {
+            return false;
+        }
+        this->cpuTime = usage.cpuTime;
+        this->peakVsz = (unsigned long)usage.peakVsz;
+        this->peakRss = (unsigned long)usage.peakRss;
+        elapsed = usage.elapsed;
+    }
+    else
+    {
+        if (!readProcessStat(this))
+        {
+            return false;
+        }
+        this->cpuTime = this->statCpuTime;
+        this->vsz = this->statVsz;
+        this->rss = this->statRss;
+        unsigned long long started = this->startTime*1000000ull/sysconf(_SC_CLK_TCK);
+        unsigned long long now = getBootMicros();
+        elapsed = now > started ? now - started : 0;
+    }
+
+    this->cpu = elapsed == 0 ? 0.0f : (float)(100.0*this->cpuTime/elapsed);
+    this->mem = (float)(100.0*this->rss/getTotalMemory());
+    this->isUsageRead = true;
+    return true;
+}
+
+// The parent's comm (its executable name, at most 15 characters), or NULL if it can't be read
+const char* getProcessParentName(Process* this)
+{
+    if (this->isParentNameRead)
+    {
+        return this->parentName;
+    }
+    this->isParentNameRead = true;
+
+    if (!readProcessStat(this))
+    {
+        return NULL;
+    }
+
+    char comm[64];
+    int length = readProcFile(this->ppid, "comm", comm, sizeof(comm));
+    if (length <= 0)
+    {
+        return NULL;
+    }
+    if (comm[length - 1] == '\n')
+    {
+        comm[length - 1] = '\0';
+    }
+    this->parentName = copyString(comm);
+    return this->parentName;
+}
+
+// The device and inode of the process's executable. Looked up once per process lifetime (a pid with the
+// same start time), so a process that execs keeps the identity of what it was first seen running.
+bool getProcessExe(Process* this, dev_t* device, ino_t* inode)
+{
+    if (!readProcessStat(this))
+    {
+        return false;
+    }
+    ProcessCacheEntry* entry = getProcessCacheEntry(this->pid, this->startTime);
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    if (!entry->isExeRead)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/exe", (int)this->pid);
+        struct stat info;
+        entry->isExeRead = true;
+        entry->hasExe = stat(path, &info) == 0;
+        if (entry->hasExe)
+        {
+            entry->exeDevice = info.st_dev;
+            entry->exeInode = info.st_ino;
+        }
+    }
+    *device = entry->exeDevice;
+    *inode = entry->exeInode;
+    return entry->hasExe;
+}
+
+// The process's cgroup v2 path (the "0::" line of /proc/<pid>/cgroup), or NULL. Read once per process
+// lifetime, like getProcessExe, so a process moved to another cgroup keeps matching by the first one.
+const char* getProcessCgroup(Process* this)
+{
+    if (!readProcessStat(this))
+    {
+        return NULL;
+    }
+    ProcessCacheEntry* entry = getProcessCacheEntry(this->pid, this->startTime);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    if (!entry->isCgroupRead)
+    {
+        entry->isCgroupRead = true;
+        char cgroup[4096];
+        if (!readProcessCgroup(this->pid, cgroup, sizeof(cgroup)))
+        {
+            return NULL;
+        }
+        entry->cgroupPath = copyString(cgroup);
+    }
+    return entry->cgroupPath;
+}
+
+// Lowers each of the process's threads to THROTTLE_NICE and the idle I/O class, which the threads it creates
+// afterwards inherit. False if it is gone.
+bool reniceProcess(pid_t pid, int pidFD)
+{
+    char tasksPath[64];
+    snprintf(tasksPath, sizeof(tasksPath), "/proc/%d/task", (int)pid);
+    DIR* tasks = opendir(tasksPath);
+    if (tasks == NULL || !signalProcess(pid, pidFD, 0))
+    {
+        if (tasks != NULL)
+        {
+            closedir(tasks);
+        }
+        return false;
+    }
+    struct dirent* task;
+    while ((task = readdir(tasks)) != NULL)
+    {
+        if (isPidName(task->d_name))
+        {
+            int tid = atoi(task->d_name);
+            setpriority(PRIO_PROCESS, (id_t)tid, THROTTLE_NICE);
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_IDLE);
+        }
+    }
+    closedir(tasks);
+    return true;
+}
+
+//private
+bool adviseRanges(int pidFD, struct iovec* ranges, int count)
+{
+    return count > 0 && syscall(SYS_process_madvise, pidFD, ranges, (size_t)count, MADV_PAGEOUT, 0u) > 0;
+}
+
+// Asks the kernel to page out every mapping of the process with process_madvise(MADV_PAGEOUT) (Linux 5.10, with
+// CAP_SYS_NICE over the process). Its anonymous memory only goes if there is swap. The pidfd makes sure it is
+// the same process. False if nothing could be advised.
+bool pageOutProcess(pid_t pid, int pidFD)
+{
+    char mapsPath[64];
+    snprintf(mapsPath, sizeof(mapsPath), "/proc/%d/maps", (int)pid);
+    FILE* maps = pidFD < 0 ? NULL : fopen(mapsPath, "r");
+    if (maps == NULL)
+    {
+        return false;
+    }
+    struct iovec ranges[MAX_PAGEOUT_RANGES];
+    int count = 0;
+    bool isAdvised = false;
+    bool isLineStart = true;
+    char line[512];
+    while (fgets(line, sizeof(line), maps) != NULL)
+    {
+        // The rest of a line with a long path comes in pieces
+        bool wasLineStart = isLineStart;
+        isLineStart = strchr(line, '\n') != NULL;
+        unsigned long start;
+        unsigned long end;
+        // The kernel's own mappings can't be advised, and fail the whole call
+        if (!wasLineStart || sscanf(line, "%lx-%lx", &start, &end) != 2 || strstr(line, "[vsyscall]") != NULL
+            || strstr(line, "[vvar]") != NULL || strstr(line, "[vdso]") != NULL)
+        {
+            continue;
+        }
+        ranges[count].iov_base = (void*)start;
+        ranges[count].iov_len = end - start;
+        if (++count == MAX_PAGEOUT_RANGES)
+        {
+            isAdvised = adviseRanges(pidFD, ranges, count) || isAdvised;
+            count = 0;
+        }
+    }
+    fclose(maps);
+    return adviseRanges(pidFD, ranges, count) || isAdvised;
+}
+
+// Calls visit with each child of each thread of the process, from /proc/<pid>/task/<tid>/children (which needs
+// CONFIG_PROC_CHILDREN). Nothing is called if the process is gone.
+void forEachChild(pid_t pid, ChildVisitor visit, void* context)
+{
+    char tasksPath[64];
+    snprintf(tasksPath, sizeof(tasksPath), "/proc/%d/task", (int)pid);
+    DIR* tasks = opendir(tasksPath);
+    if (tasks == NULL)
+    {
+        return;
+    }
+    struct dirent* task;
+    while ((task = readdir(tasks)) != NULL)
+    {
+        if (!isPidName(task->d_name))
+        {
+            continue;
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)pid, atoi(task->d_name));
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            continue;
+        }
+        // A piece at a time, so that there can be any number of children. Every pid is followed by a space, so one
+        // without is cut off at the end of the piece, and is kept for the next.
+        char children[4096];
+        int kept = 0;
+        int length;
+        while ((length = (int)read(fd, children + kept, sizeof(children) - 1 - kept)) > 0)
+        {
+            length += kept;
+            children[length] = '\0';
+            char* next = children;
+            char* end;
+            long child;
+            while ((child = strtol(next, &end, 10)) > 0 && end != next && *end == ' ')
+            {
+                visit((pid_t)child, context);
+                next = end;
+            }
+            kept = length - (int)(next - children);
+            memmove(children, next, kept);
+        }
+        close(fd);
+    }
+    closedir(tasks);
+}
+
+// The cgroup v2 path of a process, as /proc/<pid>/cgroup has it, uncached. False if it is gone, or not in
+// the v2 hierarchy.
+bool readProcessCgroup(pid_t pid, char* path, int size)
+{
+    char cgroups[4096];
+    if (readProcFile(pid, "cgroup", cgroups, sizeof(cgroups)) < 0)
+    {
+        return false;
+    }
+    char* line = cgroups;
+    while (line != NULL && strncmp(line, "0::", 3) != 0)
+    {
+        line = strchr(line, '\n');
+        line = line == NULL ? NULL : line + 1;
+    }
+    if (line == NULL)
+    {
+        return false;
+    }
+    line += 3;
+    char* lineEnd = strchr(line, '\n');
+    if (lineEnd != NULL)
+    {
+        *lineEnd = '\0';
+    }
+    snprintf(path, size, "%s", line);
+    return true;
 }
\ No newline at end of file
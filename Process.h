@@ -20,24 +20,74 @@ limitations under the License.
 #include <sys/types.h>
 #include <stdbool.h>
 
+// The kernel's limit on /proc/<pid>/comm, not counting the NUL
+#define MAX_COMM_LENGTH 15
+
 typedef struct
 {
-	char* user;
 	pid_t pid;
-	double cpu;
-	double mem;
-	int vsz;
-	int rss;
-	char* tty;
-	char* stat;
-	char* start;
-	char* time;
+	char comm[MAX_COMM_LENGTH + 1];
+
+	// Read from /proc on demand, see getProcessCommand, getProcessUid, getProcessParentName, getProcessExe
+	// and getProcessCgroup
+	bool isCommandRead;
+	bool isUidRead;
+	bool isStatRead;
+	bool isParentNameRead;
+	// As ps shows it: the arguments separated by spaces, or [comm] if there are none
 	char* command;
+	uid_t uid;
+	pid_t ppid;
+	unsigned long long startTime;
+	char* parentName;
+
+	// See getProcessUsage. As ps shows them: CPU time as a percentage of the time since the process started,
+	// resident size as a percentage of physical memory, and the virtual and resident sizes in KiB.
+	bool isUsageRead;
+	float cpu;
+	float mem;
+	unsigned long vsz;
+	unsigned long rss;
+	// The high-water marks of the two sizes, in KiB. Only taskstats has them, so they stay 0 without it.
+	unsigned long peakVsz;
+	unsigned long peakRss;
+	// User plus system time, in microseconds
+	unsigned long long cpuTime;
+	// The same, as /proc/<pid>/stat has them
+	unsigned long long statCpuTime;
+	unsigned long statVsz;
+	unsigned long statRss;
 } Process;
 
+// Decides from its comm alone whether a process is worth looking at more closely
+typedef bool (*ProcessFilter)(const char* comm, const void* context);
+typedef void (*ChildVisitor)(pid_t child, void* context);
+
 void destroyProcessArray(Process** array, int count);
-Process* processConstructor(char* processString);
+Process* processConstructor(pid_t pid, const char* comm);
 void processDestructor(Process* this);
 Process** searchRunningProcesses(int* processesFound, const char* processName, bool ignoreCmdOptions);
 bool killProcess(Process process);
+int openProcessFD(pid_t pid);
+bool signalProcess(pid_t pid, int pidFD, int signal);
+bool waitForProcessExit(pid_t pid, int pidFD, int timeoutMillis);
+bool reniceProcess(pid_t pid, int pidFD);
+bool pageOutProcess(pid_t pid, int pidFD);
+Process** getRunningProcesses(int* processesFound, ProcessFilter isCandidate, const void* context);
+const char* getCommKey(const char* name, int* length);
+bool isCommOf(const char* comm, const char* name);
+void initProcessQuery(Process* this, pid_t pid, char* command);
+void clearProcessQuery(Process* this);
+const char* getProcessCommand(Process* this);
+bool getProcessUid(Process* this, uid_t* uid);
+const char* getProcessParentName(Process* this);
+bool getProcessExe(Process* this, dev_t* device, ino_t* inode);
+const char* getProcessCgroup(Process* this);
+bool readProcessCgroup(pid_t pid, char* path, int size);
+void forEachChild(pid_t pid, ChildVisitor visit, void* context);
+bool getProcessStartTime(Process* this, unsigned long long* startTime);
+unsigned long long getBootMicros();
+bool getProcessUsage(Process* this);
+int readProcFile(pid_t pid, const char* name, char* buffer, int size);
+bool isPidName(const char* name);
 #endif
\ No newline at end of file
@@ -0,0 +1,131 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ProcessCache.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include "memwatch.h"
+
+// An open addressing hash table on pid. Entries are never deleted one by one: when the table fills up it is
+// rebuilt with only the processes seen in the last refresh or two, which also drops the ones that exited.
+
+#define MINIMUM_CACHE_CAPACITY 256
+
+static ProcessCacheEntry* entries = NULL;
+static unsigned int capacity = 0;
+static unsigned int count = 0;
+static unsigned int generation = 1;
+
+// Called once per snapshot of the running processes
+void advanceProcessCache()
+{
+    ++generation;
+}
+
+//private
+ProcessCacheEntry* findSlot(ProcessCacheEntry* table, unsigned int tableCapacity, pid_t pid)
+{
+    unsigned int mask = tableCapacity - 1;
+    unsigned int i = ((unsigned int)pid*2654435761u) & mask;
+    while (table[i].pid != 0 && table[i].pid != pid)
+    {
+        i = (i + 1) & mask;
+    }
+    return &table[i];
+}
+
+//private
+bool rebuildProcessCache()
+{
+    unsigned int kept = 0;
+    unsigned int i;
+    for (i = 0; i < capacity; ++i)
+    {
+        if (entries[i].pid != 0 && entries[i].lastSeen + 1 >= generation)
+        {
+            ++kept;
+        }
+    }
+
+    unsigned int newCapacity = MINIMUM_CACHE_CAPACITY;
+    while (newCapacity < (kept + 1)*4)
+    {
+        newCapacity *= 2;
+    }
+
+    ProcessCacheEntry* newEntries = (ProcessCacheEntry*)calloc(newCapacity, sizeof(ProcessCacheEntry));
+    LogReport report;
+    if (!checkMallocResult(newEntries, &report))
+    {
+        saveLogReport(report);
+        return false;
+    }
+
+    for (i = 0; i < capacity; ++i)
+    {
+        if (entries[i].pid != 0 && entries[i].lastSeen + 1 >= generation)
+        {
+            *findSlot(newEntries, newCapacity, entries[i].pid) = entries[i];
+        }
+        else
+        {
+            free(entries[i].cgroupPath);
+        }
+    }
+    free(entries);
+    entries = newEntries;
+    capacity = newCapacity;
+    count = kept;
+    return true;
+}
+
+// The entry for the process, created empty the first time it is seen. NULL only when out of memory.
+ProcessCacheEntry* getProcessCacheEntry(pid_t pid, unsigned long long startTime)
+{
+    if ((count + 1)*2 > capacity && !rebuildProcessCache())
+    {
+        return NULL;
+    }
+
+    ProcessCacheEntry* entry = findSlot(entries, capacity, pid);
+    if (entry->pid == 0 || entry->startTime != startTime)
+    {
+        if (entry->pid == 0)
+        {
+            ++count;
+        }
+        free(entry->cgroupPath);
+        memset(entry, 0, sizeof(ProcessCacheEntry));
+        entry->pid = pid;
+        entry->startTime = startTime;
+    }
+    entry->lastSeen = generation;
+    return entry;
+}
+
+void destroyProcessCache()
+{
+    unsigned int i;
+    for (i = 0; i < capacity; ++i)
+    {
+        free(entries[i].cgroupPath);
+    }
+    free(entries);
+    entries = NULL;
+    capacity = 0;
+    count = 0;
+}
\ No newline at end of file
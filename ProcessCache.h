@@ -0,0 +1,45 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __PROCESS_CACHE_H__
+#define __PROCESS_CACHE_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+// What procnanny has found out about one process, kept across refreshes for as long as the process lives.
+// A process is identified by its pid and start time (in clock ticks since boot), so a reused pid starts over.
+typedef struct
+{
+	pid_t pid;
+	unsigned long long startTime;
+	unsigned int lastSeen;
+
+	// From stat on /proc/<pid>/exe. hasExe is false if it couldn't be read.
+	bool isExeRead;
+	bool hasExe;
+	dev_t exeDevice;
+	ino_t exeInode;
+
+	// The cgroup v2 path, from /proc/<pid>/cgroup. NULL if it couldn't be read.
+	bool isCgroupRead;
+	char* cgroupPath;
+} ProcessCacheEntry;
+
+void advanceProcessCache();
+ProcessCacheEntry* getProcessCacheEntry(pid_t pid, unsigned long long startTime);
+void destroyProcessCache();
+#endif
\ No newline at end of file
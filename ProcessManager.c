@@ -18,205 +18,654 @@ limitations under the License.
 #include "Logging.h"
 #include "Utils.h"
 #include "MonitorRequest.h"
+#include "RuleSet.h"
+#include "ProcessCache.h"
+#include "StatFiles.h"
+#include "ProcUring.h"
+#include "Taskstats.h"
+#include "ResourceSampler.h"
+#include "CgroupBackend.h"
+#include "Pressure.h"
+#include "ProcessTree.h"
+#include "Descendants.h"
+#include "ConfigCompiler.h"
 #include "RegisterEntry.h"
 #include "ProgramIO.h"
+#include "ConfigWatcher.h"
 #include <sys/types.h>
 #include <signal.h>
 #include <assert.h>
+#include <poll.h>
+#include <limits.h>
+#include <string.h>
 #include "memwatch.h"
 
 const char* PROGRAM_NAME = "procnanny";
 
-MonitorRequest** monitorRequests = NULL;
-int configLength = 0;
+const char* RETARGET_ENV_VAR = "PROCNANNYRETARGET";
+
 RegisterEntry* root = NULL;
+// Set after a new config is swapped in, so the new rules that match nothing get logged once
+bool reportMissingRequests = false;
 
 int writingToParent = 0;
 int readingFromParent = 0;
 
 bool sigintReceived = false;
 bool readConfig = false;
+bool configChanged = false;
 
 //private
 void cleanupGlobals()
 {
-    destroyMonitorRequestArray(monitorRequests, configLength);
     destructChain(root);
+    stopConfigWatcher();
+    destroyProcessCache();
+    closeStatFiles();
+    stopProcUring();
+    stopTaskstats();
+    stopSampler();
+    stopDescendants();
+    stopPressureTrigger();
+}
+
+//private
+void writeChildStatus(ProcessStatusCode status, int millis)
+{
+    char message[1 + sizeof(int)];
+    message[0] = status;
+    memcpy(message + 1, &millis, sizeof(int));
+    write(writingToParent, message, status == TERMINATED ? sizeof(message) : 1);
+}
+
+//private
+bool signalTarget(pid_t pid, int pidFD, int signal, bool killTree)
+{
+    return killTree ? signalProcessTree(pid, pidFD, signal) : signalProcess(pid, pidFD, signal);
 }
 
 //private
-ProcessStatusCode childMain(pid_t pid, int duration)
+// Sends killSignal, reports that, and gives the process graceSeconds to exit before SIGKILL. The exit is
+// noticed through the pidfd as soon as it happens.
+ProcessStatusCode escalateKill(pid_t pid, int pidFD, int killSignal, unsigned int graceSeconds, bool killTree)
 {
-    sleep(duration);
-    int result = kill(pid, SIGKILL);
-    if (result == 0)
+    if (!signalTarget(pid, pidFD, killSignal, killTree))
     {
-        return KILLED;
+        return DIED;
     }
-    else
+    long long signalledAt = getMonotonicMillis();
+    writeChildStatus(SIGNALLED, 0);
+
+    if (!waitForProcessExit(pid, pidFD, (int)graceSeconds*1000) && signalTarget(pid, pidFD, SIGKILL, killTree))
     {
-        return DIED;
+        return KILLED;
     }
+    writeChildStatus(TERMINATED, (int)(getMonotonicMillis() - signalledAt));
+    return TERMINATED;
 }
 
 //private
-void setupMonitoring(bool isRetry, char* processName, unsigned long int duration, RegisterEntry* head, RegisterEntry* tail)
+// Waits out the duration, unless the parent retargets it in between (which also replaces the rest of the rule),
+// lowering the process's priority on the way if it has a soft=. Reports to the parent once done.
+void childMain(pid_t pid, unsigned long int duration, int killSignal, unsigned int graceSeconds, bool killTree,
+    int throttleAfter)
 {
-    int num = 0;
-    Process** runningProcesses = searchRunningProcesses(&num, processName, false);
-    if (runningProcesses == NULL)
+    // Opened now, so that the process is still the one being monitored when the time comes
+    int pidFD = openProcessFD(pid);
+    long long started = getMonotonicMillis();
+    long long deadline = started + (long long)duration*1000;
+    long long throttleAt = throttleAfter == NO_THROTTLE ? LLONG_MAX : started + (long long)throttleAfter*1000;
+    bool isThrottled = false;
+    long long remaining;
+    while ((remaining = deadline - getMonotonicMillis()) > 0)
     {
-        // Nothing to be done
-        if (num == 0)
+        long long untilThrottle = throttleAt - getMonotonicMillis();
+        if (untilThrottle <= 0)
         {
-            if (!isRetry)
+            throttleAt = LLONG_MAX;
+            isThrottled = true;
+            if (!reniceProcess(pid, pidFD))
             {
-                LogReport report;
-                report.message = stringJoin("No process found with name: ", processName);
-                report.type = INFO;
-                saveLogReport(report);
-                free(report.message);
+                break;
             }
+            writeChildStatus(THROTTLED, 0);
+            continue;
+        }
+        remaining = untilThrottle < remaining ? untilThrottle : remaining;
 
-            return;
+        struct pollfd parent;
+        parent.fd = readingFromParent;
+        parent.events = POLLIN;
+        if (poll(&parent, 1, remaining > INT_MAX ? INT_MAX : (int)remaining) <= 0)
+        {
+            continue;
+        }
+
+        MonitorMessage message;
+        assert(read(readingFromParent, &message, sizeof(MonitorMessage)) == sizeof(MonitorMessage));
+        if (message.isRetarget && message.targetPid == pid)
+        {
+            deadline = started + (long long)message.monitorDuration*1000;
+            killSignal = message.killSignal;
+            graceSeconds = message.graceSeconds;
+            killTree = message.killTree;
+            // A process that has been throttled stays so
+            if (!isThrottled)
+            {
+                throttleAt = message.throttleAfter == NO_THROTTLE ? LLONG_MAX
+                    : started + (long long)message.throttleAfter*1000;
+            }
         }
-        exit(-1);
     }
 
-    int i;
-    for(i = 0; i < num; ++i)
+    ProcessStatusCode status;
+    if (killSignal != 0)
     {
-        Process* p = runningProcesses[i];
+        status = escalateKill(pid, pidFD, killSignal, graceSeconds, killTree);
+    }
+    else
+    {
+        status = signalTarget(pid, pidFD, SIGKILL, killTree) ? KILLED : DIED;
+    }
+    if (status != TERMINATED)
+    {
+        writeChildStatus(status, 0);
+    }
+    if (pidFD >= 0)
+    {
+        close(pidFD);
+    }
+}
+
+//private
+// The soft= of the request, as a worker takes it
+int getThrottleAfter(const MonitorRequest* request)
+{
+    return request->limits.throttleCpu == 0 ? NO_THROTTLE : (int)request->limits.softSeconds;
+}
 
-        if (p -> pid == getpid())
+//private
+void monitorProcess(Process* p, MonitorRequest* request, RegisterEntry* head, RegisterEntry* tail, Process** runningProcesses, int num)
+{
+    unsigned long int duration = request->monitorDuration;
+    int killSignal = request->limits.signal;
+    unsigned int graceSeconds = request->limits.graceSeconds;
+    bool killTree = request->limits.killTree;
+    int throttleAfter = getThrottleAfter(request);
+    if (p -> pid == getpid())
+    {
+        // If procnannys were killed in the beginning, but a new one was started in between and the user expects to track that.
+        // Should never happen/be done.
+        LogReport report;
+        report.message = "Config file had procnanny as one of the entries. It will be ignored if no other procnanny is found.";
+        report.type = WARNING;
+        saveLogReport(report);
+        return;
+    }
+
+    if (isProcessAlreadyBeingMonitored(p->pid, head))
+    {
+        return;
+    }
+
+    logProcessMonitoringInit(p->command, p->pid);
+
+    RegisterEntry* freeChild = getFirstFreeChild(head);
+    if (freeChild == NULL)
+    {
+        // fork a new child
+        int writeToChildFD[2];
+        int readFromChildFD[2];
+        if (pipe(writeToChildFD) < 0)
         {
-            // If procnannys were killed in the beginning, but a new one was started in between and the user expects to track that.
-            // Should never happen/be done.
+            destroyProcessArray(runningProcesses, num);
             LogReport report;
-            report.message = "Config file had procnanny as one of the entries. It will be ignored if no other procnanny is found.";
-            report.type = WARNING;
+            report.message = "Pipe creation error when trying to monitor new process.";
+            report.type = ERROR;
             saveLogReport(report);
-            continue;
+            printLogReport(report);
+            // TODO: Kill all children
+            // TODO: Log all final kill count
+            exit(-1);
         }
 
-        if (isProcessAlreadyBeingMonitored(p->pid, head))
+        if (pipe(readFromChildFD) < 0)
         {
-            continue;
+            destroyProcessArray(runningProcesses, num);
+            LogReport report;
+            report.message = "Pipe creation error when trying to monitor new process.";
+            report.type = ERROR;
+            saveLogReport(report);
+            printLogReport(report);
+            // TODO: Kill all children
+            // TODO: Log all final kill count
+            exit(-1);
         }
 
-        logProcessMonitoringInit(processName, p->pid);
-
-        RegisterEntry* freeChild = getFirstFreeChild(head);
-        if (freeChild == NULL)
+        pid_t forkPid = fork();
+        switch (forkPid)
         {
-            // fork a new child
-            int writeToChildFD[2];
-            int readFromChildFD[2];
-            if (pipe(writeToChildFD) < 0)
-            {
+            case -1:
                 destroyProcessArray(runningProcesses, num);
-                LogReport report;
-                report.message = "Pipe creation error when trying to monitor new process.";
-                report.type = ERROR;
-                saveLogReport(report);
-                printLogReport(report);
-                // TODO: Kill all children
-                // TODO: Log all final kill count
                 exit(-1);
-            }
 
-            if (pipe(readFromChildFD) < 0)
-            {
+            case CHILD:
+                close(writeToChildFD[1]);
+                close(readFromChildFD[0]);
+                writingToParent = readFromChildFD[1];
+                readingFromParent = writeToChildFD[0];
+                pid_t targetPid = p->pid;
                 destroyProcessArray(runningProcesses, num);
-                LogReport report;
-                report.message = "Pipe creation error when trying to monitor new process.";
-                report.type = ERROR;
-                saveLogReport(report);
-                printLogReport(report);
-                // TODO: Kill all children
-                // TODO: Log all final kill count
-                exit(-1);
-            }
+                cleanupGlobals();
 
-            pid_t forkPid = fork();
-            switch (forkPid)
-            {
-                case -1:
-                    destroyProcessArray(runningProcesses, num);
-                    exit(-1);
-
-                case CHILD:
-                    close(writeToChildFD[1]);
-                    close(readFromChildFD[0]);
-                    writingToParent = readFromChildFD[1];
-                    readingFromParent = writeToChildFD[0];
-                    pid_t targetPid = p->pid;
-                    destroyProcessArray(runningProcesses, num);
-                    cleanupGlobals();
-
-                    while (true)
-                    {
-                        ProcessStatusCode childStatus = childMain(targetPid, duration);
-                        write(writingToParent, &childStatus, 1);
+                while (true)
+                {
+                    childMain(targetPid, duration, killSignal, graceSeconds, killTree, throttleAfter);
 
-                        MonitorMessage message;
+                    MonitorMessage message;
+                    do
+                    {
                         assert(read(readingFromParent, &message, sizeof(MonitorMessage)) == sizeof(MonitorMessage));
-                        targetPid = message.targetPid;
-                        duration = message.monitorDuration;
                     }
+                    while (message.isRetarget); // Late retarget for the process that was just dealt with
+                    targetPid = message.targetPid;
+                    duration = message.monitorDuration;
+                    killSignal = message.killSignal;
+                    graceSeconds = message.graceSeconds;
+                    killTree = message.killTree;
+                    throttleAfter = message.throttleAfter;
+                }
+
+                break;
+
+            default:
+                 // parent
+                close(writeToChildFD[0]);
+                close(readFromChildFD[1]);
+                tail->monitoringProcess = forkPid;
+                tail->monitoredProcess = p->pid;
+                tail->monitorDuration = duration;
+                tail->killSignal = killSignal;
+                tail->graceSeconds = graceSeconds;
+                tail->killTree = killTree;
+                tail->throttleAfter = throttleAfter;
+                tail->monitoredName = copyString(p->command);
+                tail->startingTime = time(NULL);
+                tail->isAvailable = false;
+                tail->isSignalled = false;
+                tail->isThrottled = false;
+                tail->writeToChildFD = writeToChildFD[1];
+                tail->readFromChildFD = readFromChildFD[0];
+                tail->next = constuctorRegisterEntry((pid_t)0, NULL, NULL);
+                tail = tail->next;
+                holdStatFile(p->pid);
+                break;
+        }
 
-                    break;
-
-                default:
-                     // parent
-                    close(writeToChildFD[0]);
-                    close(readFromChildFD[1]);
-                    tail->monitoringProcess = forkPid;
-                    tail->monitoredProcess = p->pid;
-                    tail->monitorDuration = duration;
-                    tail->monitoredName = copyString(p->command);
-                    tail->startingTime = time(NULL);
-                    tail->isAvailable = false;
-                    tail->writeToChildFD = writeToChildFD[1];
-                    tail->readFromChildFD = readFromChildFD[0];
-                    tail->next = constuctorRegisterEntry((pid_t)0, NULL, NULL);
-                    tail = tail->next;
-                    break;
-            }
+    }
+    else
+    {
+        // use freeChild
+        freeChild->isAvailable = false;
+        freeChild->monitoredProcess = p->pid;
+        free(freeChild->monitoredName);
+        freeChild->monitoredName = copyString(p->command);
+        freeChild->monitorDuration = duration;
+        freeChild->killSignal = killSignal;
+        freeChild->graceSeconds = graceSeconds;
+        freeChild->killTree = killTree;
+        freeChild->throttleAfter = throttleAfter;
+        freeChild->startingTime = time(NULL);
+        MonitorMessage message;
+        message.targetPid = p->pid;
+        message.monitorDuration = duration;
+        message.killSignal = killSignal;
+        message.graceSeconds = graceSeconds;
+        message.killTree = killTree;
+        message.throttleAfter = throttleAfter;
+        message.isRetarget = false;
+        write(freeChild->writeToChildFD, &message, sizeof(MonitorMessage));
+        holdStatFile(p->pid);
+    }
+}
 
-        }
-        else
+//private
+void logMissingRequests(RuleSet* set, bool* found)
+{
+    unsigned int i;
+    for (i = 0; i < set->requestCount; ++i)
+    {
+        MonitorRequest* request = getMonitorRequest(set, i);
+        if (request->isNew && !request->isDuplicate && !found[i])
         {
-            // use freeChild
-            freeChild->isAvailable = false;
-            freeChild->monitoredProcess = p->pid;
-            free(freeChild->monitoredName);
-            freeChild->monitoredName = copyString(p->command);
-            freeChild->monitorDuration = duration;
-            freeChild->startingTime = time(NULL);
-            MonitorMessage message;
-            message.targetPid = p->pid;
-            message.monitorDuration = duration;
-            write(freeChild->writeToChildFD, &message, sizeof(MonitorMessage));
+            LogReport report;
+            report.message = stringJoin("No process found with name: ", getProcessName(set, request));
+            report.type = INFO;
+            saveLogReport(report);
+            free(report.message);
         }
     }
+}
 
-    destroyProcessArray(runningProcesses, num);
+//private
+// Hands the process's sampled limits to the sampler, and with the cgroup backend, its duration too, as well as
+// processes that may be killed under memory pressure. True if it still needs a worker process for its duration.
+bool trackMatchedProcess(Process* p, const MonitorRequest* request)
+{
+    ResourceLimits limits = request->limits;
+    bool isDurationSampled = startCgroupBackend();
+    if (!isDurationSampled)
+    {
+        limits.active &= ~LIMIT_WALL_TIME;
+    }
+    bool isWorkerNeeded = !isDurationSampled && (request->limits.active & LIMIT_WALL_TIME);
+    if (((limits.active & (SAMPLED_LIMITS | LIMIT_WALL_TIME)) || limits.priority != 0)
+        && trackProcess(p, &limits, request->monitorDuration) && !isWorkerNeeded)
+    {
+        logProcessMonitoringInit((char*)getProcessCommand(p), p->pid);
+    }
+    return isWorkerNeeded;
 }
 
 //private
-void rereadConfig(int argc, char** argv)
+// Monitors the descendants of the processes that matched children= rules under those rules, unless they match
+// a rule of their own
+void monitorDescendants(RuleSet* set, RegisterEntry* head, RegisterEntry* tail, Process** runningProcesses, int num)
 {
-    destroyMonitorRequestArray(monitorRequests, configLength);
-    monitorRequests = NULL;
-    configLength = 0;
-    configLength = getProcessesToMonitor(argc, argv, &monitorRequests);
+    int count;
+    Descendant* descendants = refreshDescendants(&count);
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        Process* p = descendants[i].process;
+        MonitorRequest* request = &descendants[i].request;
+        if (p->pid == getpid() || getProcessCommand(p) == NULL || findMonitorRequest(set, p) != NULL)
+        {
+            continue;
+        }
+        if (!trackMatchedProcess(p, request))
+        {
+            continue;
+        }
+        monitorProcess(p, request, head, tail, runningProcesses, num);
+        while (tail->next != NULL)
+        {
+            tail = tail->next;
+        }
+    }
+    destroyDescendantArray(descendants, count);
+}
 
-    if (configLength == -1)
+//private
+// One pass over a snapshot of the running processes, looking each one up in the current rule set
+void setupMonitoring(RegisterEntry* head, RegisterEntry* tail)
+{
+    int num = 0;
+    RuleSet* set = getCurrentRuleSet();
+    Process** runningProcesses = getRunningProcesses(&num, isCommCandidate, set);
+    if (runningProcesses == NULL)
     {
         // Already logged
         exit(-1);
     }
+
+    bool* found = NULL;
+    if (reportMissingRequests)
+    {
+        found = (bool*)calloc(set->requestCount + 1, sizeof(bool));
+    }
+
+    int i;
+    for (i = 0; i < num; ++i)
+    {
+        MonitorRequest* request = findMonitorRequest(set, runningProcesses[i]);
+        if (request == NULL)
+        {
+            continue;
+        }
+
+        if (found != NULL)
+        {
+            found[request - getMonitorRequest(set, 0)] = true;
+        }
+        Process* p = runningProcesses[i];
+        if (request->limits.children != CHILDREN_NONE && p->pid != getpid())
+        {
+            addDescendantRoot(p, request);
+        }
+        if (p->pid == getpid() || !trackMatchedProcess(p, request))
+        {
+            continue;
+        }
+        monitorProcess(p, request, head, tail, runningProcesses, num);
+        while (tail->next != NULL)
+        {
+            // Refresh tail
+            tail = tail->next;
+        }
+    }
+
+    monitorDescendants(set, head, tail, runningProcesses, num);
+    destroyProcessArray(runningProcesses, num);
+    finishTracking();
+    if (found != NULL)
+    {
+        logMissingRequests(set, found);
+        free(found);
+        reportMissingRequests = false;
+    }
+}
+
+//private
+bool isRetargetEnabled()
+{
+    const char* retarget = getenv(RETARGET_ENV_VAR);
+    return retarget != NULL && compareStrings(retarget, "1");
+}
+
+//private
+// Moves the deadline of the processes already being monitored under a rule whose duration changed, and passes
+// on changes to its signal=, grace=, kill= and soft=. The deadline stays relative to when monitoring started.
+int retargetMonitoredProcesses(RuleSet* set, RegisterEntry* head)
+{
+    int retargeted = 0;
+    time_t currentTime = time(NULL);
+    for (; head != NULL && head->monitoringProcess != (pid_t)0; head = head->next)
+    {
+        if (head->isAvailable)
+        {
+            continue;
+        }
+
+        Process process;
+        initProcessQuery(&process, head->monitoredProcess, head->monitoredName);
+        MonitorRequest* request = findMonitorRequest(set, &process);
+        clearProcessQuery(&process);
+        if (request == NULL || !(request->limits.active & LIMIT_WALL_TIME))
+        {
+            continue;
+        }
+        const ResourceLimits* limits = &request->limits;
+        int throttleAfter = getThrottleAfter(request);
+        if (request->monitorDuration == head->monitorDuration && limits->signal == head->killSignal
+            && limits->graceSeconds == head->graceSeconds && limits->killTree == head->killTree
+            && throttleAfter == head->throttleAfter)
+        {
+            continue;
+        }
+
+        // Too close to the old deadline; the worker may already be done with it
+        if (currentTime + 1 >= head->startingTime + (time_t)head->monitorDuration)
+        {
+            continue;
+        }
+
+        MonitorMessage message;
+        message.targetPid = head->monitoredProcess;
+        message.monitorDuration = request->monitorDuration;
+        message.killSignal = limits->signal;
+        message.graceSeconds = limits->graceSeconds;
+        message.killTree = limits->killTree;
+        message.throttleAfter = throttleAfter;
+        message.isRetarget = true;
+        write(head->writeToChildFD, &message, sizeof(MonitorMessage));
+        head->monitorDuration = request->monitorDuration;
+        head->killSignal = limits->signal;
+        head->graceSeconds = limits->graceSeconds;
+        head->killTree = limits->killTree;
+        head->throttleAfter = throttleAfter;
+        ++retargeted;
+    }
+    return retargeted;
+}
+
+//private
+// Switches to a newly compiled config. Only the rules that differ from the previous one matter to the
+// registry (and only if retargeting is enabled).
+void applyRuleSet(RuleSet* set)
+{
+    swapRuleSet(set);
+    reportMissingRequests = true;
+
+    int retargeted = 0;
+    if (isRetargetEnabled())
+    {
+        retargeted = retargetMonitoredProcesses(set, root);
+    }
+
+    if (set->ignoredLines > 0)
+    {
+        LogReport report;
+        report.message = stringNumberJoin("Config lines ignored for not having a process name and duration, or for an unknown option: ", set->ignoredLines);
+        report.type = WARNING;
+        saveLogReport(report);
+        free(report.message);
+    }
+    if (set->unresolvedRules > 0)
+    {
+        LogReport report;
+        report.message = stringNumberJoin("Config rules that can't match, for naming an unknown user or a missing executable: ", set->unresolvedRules);
+        report.type = WARNING;
+        saveLogReport(report);
+        free(report.message);
+    }
+    logConfigDiff(set->added, set->removed, set->changed, retargeted, set->compileMillis);
+}
+
+//private
+// Picks up what the config compiler thread finished, if anything
+void takeCompiledConfig()
+{
+    LogReport report;
+    RuleSet* set = takeCompiledRuleSet(&report);
+    if (report.message != NULL)
+    {
+        // The old config stays
+        saveLogReport(report);
+    }
+    RuleSet* current = getCurrentRuleSet();
+    if (set != NULL && set->requestCount == 0 && set->ignoredLines > 0 && current != NULL && current->requestCount > 0)
+    {
+        // Nothing but rejected lines is far more likely a botched edit than a wish to monitor nothing. Emptying
+        // the file is how to drop every rule.
+        report.message = "Config has no valid rules. The current rules stay.";
+        report.type = WARNING;
+        saveLogReport(report);
+        destroyRuleSet(set);
+        set = NULL;
+    }
+    if (set != NULL)
+    {
+        applyRuleSet(set);
+    }
+    reclaimRuleSets();
+}
+
+//private
+// Sleeps until the next refresh is due. Wakes up in between to group commit the log, to sample the processes
+// that have resource limits (and see those sent a signal= or placed in a cgroup exit), to notice changes to the
+// config file, and to act on memory pressure.
+// Returns how many processes the sampling killed.
+int waitForNextRefresh(int refreshRate)
+{
+    int killed = 0;
+    long long refreshAt = getMonotonicMillis() + (long long)refreshRate*1000;
+    while (!sigintReceived && !readConfig)
+    {
+        long long remaining = refreshAt - getMonotonicMillis();
+        if (remaining <= 0)
+        {
+            break;
+        }
+
+        int timeout = (int)remaining;
+        int logTimeout = getLogCommitTimeout();
+        if (logTimeout >= 0 && logTimeout < timeout)
+        {
+            timeout = logTimeout;
+        }
+        int reloadTimeout = getConfigReloadTimeout();
+        if (reloadTimeout >= 0 && reloadTimeout < timeout)
+        {
+            timeout = reloadTimeout;
+        }
+        int samplerTimeout = getSamplerTimeout();
+        if (samplerTimeout >= 0 && samplerTimeout < timeout)
+        {
+            timeout = samplerTimeout;
+        }
+
+        // Negative fds are skipped by poll
+        struct pollfd fds[5];
+        fds[0].fd = getConfigCompilerFD();
+        fds[0].events = POLLIN;
+        fds[1].fd = getConfigWatcherFD();
+        fds[1].events = POLLIN;
+        fds[2].fd = getSamplerExitFD();
+        fds[2].events = POLLIN;
+        fds[3].fd = getCgroupEventFD();
+        fds[3].events = POLLIN;
+        fds[4].fd = getPressureFD();
+        fds[4].events = POLLPRI;
+        if (poll(fds, 5, timeout) > 0)
+        {
+            if (fds[0].revents & POLLIN)
+            {
+                // A compiled config is waiting
+                break;
+            }
+            if (fds[1].revents & POLLIN)
+            {
+                handleConfigWatcherEvents();
+            }
+            if (fds[2].revents & POLLIN)
+            {
+                killed += handleSamplerExits();
+            }
+            if (fds[3].revents & POLLIN)
+            {
+                killed += handleCgroupEvents(noteTrackedExit);
+            }
+            if (fds[4].revents & (POLLERR | POLLNVAL))
+            {
+                // Otherwise poll would keep returning at once
+                restartPressureTrigger();
+            }
+            else if (fds[4].revents & POLLPRI)
+            {
+                killed += relievePressure();
+            }
+        }
+        logCommitIfDue();
+        killed += sampleDueProcesses();
+
+        if (isConfigReloadDue())
+        {
+            configChanged = true;
+            break;
+        }
+    }
+    return killed;
 }
 
 //private
@@ -334,38 +783,70 @@ int monitor(int refreshRate, int argc, char** argv)
     RegisterEntry* tail = root;
 
     int killCount = 0;
-    rereadConfig(argc, argv);
-    bool isRetry = false;
+    if (argc < 2)
+    {
+        LogReport report;
+        report.message = "Config file path needed as argument.";
+        report.type = ERROR;
+        saveLogReport(report);
+        printLogReport(report);
+        exit(-1);
+    }
+
+    LogReport report;
+    RuleSet* initial = getProcessesToMonitor(argv[1], NULL, &report);
+    if (initial == NULL)
+    {
+        saveLogReport(report);
+        exit(-1);
+    }
+    startConfigCompiler(argv[1], NULL);
+    startCgroupBackend();
+    // After the backend, whose subtree it watches if there is one
+    startPressureTrigger();
+    applyRuleSet(initial);
+    startConfigWatcher(argv[1]);
 
     while (!sigintReceived)
     {
-        if (readConfig)
+        if (readConfig || configChanged)
         {
-            logSighupCatch(argv[1]);
+            if (readConfig)
+            {
+                logSighupCatch(argv[1]);
+            }
+            else
+            {
+                logConfigFileChange(argv[1]);
+            }
             readConfig = false;
-            isRetry = false;
-            rereadConfig(argc, argv);
+            configChanged = false;
+            // Picked up by takeCompiledConfig once ready. Monitoring carries on with the old config until then.
+            requestConfigCompile();
+            rearmConfigWatcher();
         }
 
+        takeCompiledConfig();
+        handleTaskstatsExits();
         killCount += refreshRegisterEntries(root);
-        int i;
-        for (i = 0; i < configLength; ++i)
+        setupMonitoring(root, tail);
+        while (tail->next != NULL)
         {
-            setupMonitoring(isRetry, monitorRequests[i]->processName, monitorRequests[i]->monitorDuration, root, tail);
-            while(tail->next != NULL)
-            {
-                // Refresh tail
-                tail = tail->next;
-            }
+            // Refresh tail
+            tail = tail->next;
         }
-        sleep(refreshRate);
-        isRetry = true;
+        killCount += sampleDueProcesses();
+        killCount += waitForNextRefresh(refreshRate);
     }
 
     // Final refresh before exiting
     killCount += refreshRegisterEntries(root);
 
     killAllChildren(root);
+    reportReclaimTotals();
+    // Not in cleanupGlobals: workers must leave the cgroups alone
+    stopCgroupBackend();
     cleanupGlobals();
+    stopConfigCompiler();
     return killCount;
 }
\ No newline at end of file
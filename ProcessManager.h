@@ -26,6 +26,15 @@ typedef struct
 {
 	pid_t targetPid;
 	unsigned long int monitorDuration;
+	// How to kill it, see ResourceLimits
+	int killSignal;
+	unsigned int graceSeconds;
+	bool killTree;
+	// The rule's soft=, or NO_THROTTLE
+	int throttleAfter;
+	// Moves the deadline of targetPid, which the worker is already monitoring, and replaces how it is killed and
+	// throttled
+	bool isRetarget;
 } MonitorMessage;
 
 bool killOtherProcNannys();
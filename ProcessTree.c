@@ -0,0 +1,276 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "ProcessTree.h"
+#include "Process.h"
+#include "CgroupBackend.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "memwatch.h"
+
+// Three ways to reach the tree, best first:
+// - A process that the cgroup backend placed in a leaf of its own, before it had started anything, goes down with
+//   everything else in the leaf, by a write to its cgroup.kill (Linux 5.14). That is atomic, so nothing can fork
+//   its way out, but only does SIGKILL. Cgroups that procnanny didn't make are never killed, as they may hold a
+//   whole service.
+// - A process that leads a process group is signalled with the whole group, like a shell does with a job, but
+//   only if nothing else is in the group: the other commands of a pipeline are in their shell's job too.
+// - Otherwise the tree is walked through /proc/<pid>/task/<tid>/children (which needs CONFIG_PROC_CHILDREN).
+//   Each process is stopped before its children are read, so that none can be added behind the walk, and
+//   they are all signalled (and continued) once it is done, each through a pidfd opened as it was found.
+// The first and the last are one pass over just the tree. Checking a group takes a scan of the stat of every
+// process, as the kernel doesn't list the members of a group, and the walk never sees the members outside the
+// tree. It is only done for a process that leads its own group, for what killpg gives in return: one call that
+// signals the whole group, children forked meanwhile included, with nothing to stop and continue.
+
+#define STARTING_TREE_CAPACITY 16
+
+typedef struct
+{
+	pid_t* pids;
+	// A pidfd for each (-1 where there is none), so that a pid reused behind the walk can't be signalled
+	int* pidFDs;
+	int count;
+	int capacity;
+	// Whose children are being added, and when they were listed, in microseconds since boot
+	pid_t parent;
+	unsigned long long listedAt;
+} PidList;
+
+typedef struct
+{
+	pid_t pid;
+	pid_t ppid;
+	pid_t group;
+} ProcessLink;
+
+//private
+bool addTreePid(PidList* list, pid_t pid, int pidFD)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity == 0 ? STARTING_TREE_CAPACITY : list->capacity*2;
+        pid_t* pids = (pid_t*)realloc(list->pids, capacity*sizeof(pid_t));
+        LogReport report;
+        if (!checkMallocResult(pids, &report))
+        {
+            return false;
+        }
+        list->pids = pids;
+        int* pidFDs = (int*)realloc(list->pidFDs, capacity*sizeof(int));
+        if (!checkMallocResult(pidFDs, &report))
+        {
+            return false;
+        }
+        list->pidFDs = pidFDs;
+        list->capacity = capacity;
+    }
+    list->pids[list->count] = pid;
+    list->pidFDs[list->count] = pidFD;
+    ++list->count;
+    return true;
+}
+
+//private
+int compareLinks(const void* first, const void* second)
+{
+    pid_t firstPid = ((const ProcessLink*)first)->pid;
+    pid_t secondPid = ((const ProcessLink*)second)->pid;
+    return (firstPid > secondPid) - (firstPid < secondPid);
+}
+
+//private
+// True if every process in the leader's group is the leader or one of its descendants, from the ppid and group
+// of every process in /proc
+bool isGroupInTree(pid_t leader)
+{
+    DIR* proc = opendir("/proc");
+    if (proc == NULL)
+    {
+        return false;
+    }
+    ProcessLink* links = NULL;
+    int count = 0;
+    int capacity = 0;
+    bool isInTree = true;
+    struct dirent* entry;
+    while ((entry = readdir(proc)) != NULL)
+    {
+        if (!isPidName(entry->d_name))
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity == 0 ? STARTING_TREE_CAPACITY : capacity*2;
+            ProcessLink* grown = (ProcessLink*)realloc(links, capacity*sizeof(ProcessLink));
+            LogReport report;
+            if (!checkMallocResult(grown, &report))
+            {
+                isInTree = false;
+                break;
+            }
+            links = grown;
+        }
+        // A process that is gone by now is in no group
+        pid_t pid = (pid_t)atoi(entry->d_name);
+        char stat[1024];
+        char* commEnd;
+        int ppid;
+        int group;
+        if (readProcFile(pid, "stat", stat, sizeof(stat)) > 0 && (commEnd = strrchr(stat, ')')) != NULL
+            && sscanf(commEnd + 1, " %*c %d %d", &ppid, &group) == 2)
+        {
+            links[count].pid = pid;
+            links[count].ppid = (pid_t)ppid;
+            links[count].group = (pid_t)group;
+            ++count;
+        }
+    }
+    closedir(proc);
+
+    if (isInTree)
+    {
+        qsort(links, count, sizeof(ProcessLink), compareLinks);
+    }
+    int i;
+    for (i = 0; isInTree && i < count; ++i)
+    {
+        if (links[i].group != leader)
+        {
+            continue;
+        }
+        // Bounded by the count, in case of a loop from pids reused during the scan
+        pid_t ancestor = links[i].pid;
+        int steps;
+        for (steps = 0; ancestor != leader && ancestor > 1 && steps < count; ++steps)
+        {
+            ProcessLink key;
+            key.pid = ancestor;
+            ProcessLink* link = (ProcessLink*)bsearch(&key, links, count, sizeof(ProcessLink), compareLinks);
+            ancestor = link == NULL ? 0 : link->ppid;
+        }
+        isInTree = ancestor == leader;
+    }
+    free(links);
+    return isInTree;
+}
+
+//private
+// The child is checked through its start time and its parent once its pidfd is open: one that started after the
+// list was read, or that has another parent, has taken over the pid of a process that exited since
+void addTreeChild(pid_t child, void* tree)
+{
+    PidList* list = (PidList*)tree;
+    int pidFD = openProcessFD(child);
+    Process process;
+    initProcessQuery(&process, child, NULL);
+    unsigned long long startTime;
+    bool isRead = getProcessStartTime(&process, &startTime);
+    pid_t parent = process.ppid;
+    clearProcessQuery(&process);
+    if (!isRead || parent != list->parent || startTime*1000000ull/sysconf(_SC_CLK_TCK) > list->listedAt
+        || !addTreePid(list, child, pidFD))
+    {
+        if (pidFD >= 0)
+        {
+            close(pidFD);
+        }
+    }
+}
+
+//private
+bool signalWalkedTree(pid_t pid, int pidFD, int signal)
+{
+    if (!signalProcess(pid, pidFD, SIGSTOP))
+    {
+        return false;
+    }
+    PidList tree;
+    memset(&tree, 0, sizeof(PidList));
+    addTreePid(&tree, pid, pidFD);
+    int i;
+    for (i = 0; i < tree.count; ++i)
+    {
+        if (i > 0)
+        {
+            signalProcess(tree.pids[i], tree.pidFDs[i], SIGSTOP);
+        }
+        tree.parent = tree.pids[i];
+        tree.listedAt = getBootMicros();
+        forEachChild(tree.pids[i], addTreeChild, &tree);
+    }
+
+    for (i = 0; i < tree.count; ++i)
+    {
+        signalProcess(tree.pids[i], tree.pidFDs[i], signal);
+    }
+    if (signal != SIGKILL)
+    {
+        // So that they can act on it
+        for (i = 0; i < tree.count; ++i)
+        {
+            signalProcess(tree.pids[i], tree.pidFDs[i], SIGCONT);
+        }
+    }
+    // The first is the caller's
+    for (i = 1; i < tree.count; ++i)
+    {
+        if (tree.pidFDs[i] >= 0)
+        {
+            close(tree.pidFDs[i]);
+        }
+    }
+    free(tree.pids);
+    free(tree.pidFDs);
+    return true;
+}
+
+// True if the process itself got the signal. The pidfd, if not -1, makes sure that it is the same process.
+bool signalProcessTree(pid_t pid, int pidFD, int signal)
+{
+    if (signal == SIGKILL)
+    {
+        Process process;
+        initProcessQuery(&process, pid, NULL);
+        unsigned long long startTime;
+        bool isRead = getProcessStartTime(&process, &startTime);
+        clearProcessQuery(&process);
+        if (isRead && signalProcess(pid, pidFD, 0) && killCgroup(pid, startTime))
+        {
+            return true;
+        }
+    }
+
+    pid_t group = getpgid(pid);
+    if (group == pid && group != getpgrp() && isGroupInTree(group))
+    {
+        // Through the pidfd first, so that a process that took over the pid doesn't take its group down
+        if (!signalProcess(pid, pidFD, signal))
+        {
+            return false;
+        }
+        killpg(group, signal);
+        return true;
+    }
+    return signalWalkedTree(pid, pidFD, signal);
+}
\ No newline at end of file
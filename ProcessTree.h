@@ -0,0 +1,26 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef __PROCESS_TREE_H__
+#define __PROCESS_TREE_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+// Signals a process together with everything it has started, for rules with kill=tree
+bool signalProcessTree(pid_t pid, int pidFD, int signal);
+#endif
\ No newline at end of file
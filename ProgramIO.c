@@ -17,6 +17,10 @@ limitations under the License.
 #include "ProgramIO.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "memwatch.h"
 
 #define STARTING_ALLOCATION_SIZE 128
@@ -96,10 +100,89 @@ void freeOutputFromProgram(char** output, int numberLinesRead)
     free(output);
 }
 
-char** readFile(const char* filePath, int* numberLinesRead, LogReport* report)
+// The whole file, read into an anonymous mapping rather than mapped in place: the caller parses it more than once and
+// needs the same bytes each time, whatever happens to the file meanwhile, and a file truncated under a live mapping
+// faults. An anonymous mapping since the config compiler thread can't use malloc.
+void* loadFile(const char* filePath, size_t* size, LogReport* report)
 {
-    char* catCall = stringJoin("cat ", filePath);
-    char** lines = getOutputFromProgram(catCall, numberLinesRead, report);
-    free(catCall);
-    return lines;
+    int fd = open(filePath, O_RDONLY);
+    if (fd < 0)
+    {
+        report -> message = "Failed to open file.";
+        report -> type = ERROR;
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        close(fd);
+        report -> message = "Failed to stat file.";
+        report -> type = ERROR;
+        return NULL;
+    }
+
+    size_t capacity = (size_t)info.st_size;
+    *size = 0;
+    if (capacity == 0)
+    {
+        // mmap refuses empty mappings. NULL without a report means there is simply nothing to read.
+        close(fd);
+        return NULL;
+    }
+
+    char* data = (char*)mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        report -> message = "Failed to map file.";
+        report -> type = ERROR;
+        return NULL;
+    }
+
+    // Anything appended after the fstat is left for the next load
+    while (*size < capacity)
+    {
+        ssize_t count = read(fd, data + *size, capacity - *size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            close(fd);
+            munmap(data, capacity);
+            report -> message = "Failed to read file.";
+            report -> type = ERROR;
+            return NULL;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        *size += (size_t)count;
+    }
+    close(fd);
+
+    if (*size == 0)
+    {
+        munmap(data, capacity);
+        return NULL;
+    }
+    // Truncated since the fstat: give back the pages past the end, so that unloadFile can go by *size
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t usedPages = (*size + pageSize - 1)/pageSize*pageSize;
+    if (usedPages < capacity)
+    {
+        munmap(data + usedPages, capacity - usedPages);
+    }
+    return data;
+}
+
+void unloadFile(void* data, size_t size)
+{
+    if (data != NULL)
+    {
+        munmap(data, size);
+    }
 }
\ No newline at end of file
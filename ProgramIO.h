@@ -19,8 +19,11 @@ limitations under the License.
 
 #include "Logging.h"
 #include "Utils.h"
+#include <stddef.h>
 
 char** getOutputFromProgram(const char* programName, int * numberLinesRead, LogReport* report);
 void freeOutputFromProgram(char** output, int numberLinesRead);
-char** readFile(const char* filePath, int* numberLinesRead, LogReport* report);
+
+void* loadFile(const char* filePath, size_t* size, LogReport* report);
+void unloadFile(void* data, size_t size);
 #endif
\ No newline at end of file
@@ -16,8 +16,12 @@ limitations under the License.
 
 #include "RegisterEntry.h"
 #include "Utils.h"
+#include "StatFiles.h"
+#include "MonitorRequest.h"
 #include <assert.h>
 #include <signal.h>
+#include <stdio.h>
+#include <poll.h>
 #include "memwatch.h"
 
 RegisterEntry* constuctorRegisterEntry(pid_t monitoringProcess, Process* monitoredProcess, RegisterEntry* next)
@@ -34,6 +38,19 @@ RegisterEntry* constuctorRegisterEntry(pid_t monitoringProcess, Process* monitor
         entry->monitoredProcess = monitoredProcess->pid;
         entry->monitoredName = copyString(monitoredProcess->command);
     }
+    // Set for real by monitorProcess. Until then (and for the empty entry at the end of the chain) it must not
+    // look like it has a worker to hear from.
+    entry->monitorDuration = 0;
+    entry->killSignal = 0;
+    entry->graceSeconds = 0;
+    entry->killTree = false;
+    entry->throttleAfter = NO_THROTTLE;
+    entry->startingTime = 0;
+    entry->isAvailable = true;
+    entry->isSignalled = false;
+    entry->isThrottled = false;
+    entry->writeToChildFD = -1;
+    entry->readFromChildFD = -1;
     entry->next = next;
     return entry;
 }
@@ -78,6 +95,26 @@ Process* findMonitoredProcess(pid_t monitoringProcess, RegisterEntry* reg, unsig
     return NULL;
 }
 
+//private
+// Whether the worker has reported. Only waited for at the soft= and at the deadline; after that, the grace
+// period can end whenever the process exits.
+bool isStatusDue(RegisterEntry* entry, time_t currentTime)
+{
+    if (!entry->isSignalled)
+    {
+        if (entry->throttleAfter != NO_THROTTLE && !entry->isThrottled
+            && currentTime > entry->startingTime + (time_t)entry->throttleAfter)
+        {
+            return true;
+        }
+        return currentTime > entry->startingTime + (time_t)entry->monitorDuration;
+    }
+    struct pollfd status;
+    status.fd = entry->readFromChildFD;
+    status.events = POLLIN;
+    return poll(&status, 1, 0) > 0;
+}
+
 bool isHeadNull(RegisterEntry* head)
 {
     return (head == NULL || head->monitoringProcess == (pid_t)0);
@@ -95,21 +132,52 @@ int refreshRegisterEntries(RegisterEntry* head)
     time_t currentTime = time(NULL);
     while (head != NULL)
     {
-        if (!(head->isAvailable) && (currentTime > head->startingTime + head->monitorDuration))
+        if (!(head->isAvailable) && isStatusDue(head, currentTime))
         {
             ProcessStatusCode message;
             assert(read(head->readFromChildFD, &message, 1) == 1);
 
             LogReport report;
+            char reason[64];
+            int millis;
             switch(message)
             {
+                case SIGNALLED:
+                    head->isSignalled = true;
+                    snprintf(reason, sizeof(reason), "after exceeding %lu seconds", head->monitorDuration);
+                    logSignalSent(head->monitoredProcess, head->monitoredName, getSignalName(head->killSignal), reason,
+                        head->graceSeconds);
+                    head = head->next;
+                    continue;
+
+                case THROTTLED:
+                    head->isThrottled = true;
+                    logThrottle(head->monitoredProcess, head->monitoredName, "to the lowest CPU and I/O priority",
+                        (unsigned int)head->throttleAfter);
+                    head = head->next;
+                    continue;
+
+                case TERMINATED:
+                    assert(read(head->readFromChildFD, &millis, sizeof(int)) == sizeof(int));
+                    ++killed;
+                    logSignalExit(head->monitoredProcess, head->monitoredName, getSignalName(head->killSignal), millis);
+                    break;
+
                 case DIED:
                     logSelfDying(head->monitoredProcess, head->monitoredName, head->monitorDuration);
                     break;
 
                 case KILLED:
                     ++killed;
-                    logProcessKill(head->monitoredProcess, head->monitoredName, head->monitorDuration);
+                    if (head->isSignalled)
+                    {
+                        logGraceKill(head->monitoredProcess, head->monitoredName, getSignalName(head->killSignal),
+                            head->graceSeconds);
+                    }
+                    else
+                    {
+                        logProcessKill(head->monitoredProcess, head->monitoredName, head->monitorDuration);
+                    }
                     break;
 
                 case FAILED:
@@ -124,6 +192,9 @@ int refreshRegisterEntries(RegisterEntry* head)
                     break;
             }
 
+            releaseStatFile(head->monitoredProcess);
+            head->isSignalled = false;
+            head->isThrottled = false;
             head->isAvailable = true;
         }
         head = head->next;
@@ -24,20 +24,37 @@ limitations under the License.
 
 #define SIGKILL_CHILD SIGKILL
 
+// What a worker reports about its process. With a soft=, THROTTLED comes first, once the process has been.
+// With a signal=, SIGNALLED comes at the deadline, and then TERMINATED (followed by an int of milliseconds since
+// the signal) or KILLED once it is over.
 typedef char ProcessStatusCode;
+#define THROTTLED (ProcessStatusCode)5
+#define TERMINATED (ProcessStatusCode)4
+#define SIGNALLED (ProcessStatusCode)3
 #define DIED (ProcessStatusCode)2
 #define NOT_FOUND (ProcessStatusCode)1
 #define KILLED (ProcessStatusCode)0
 #define FAILED (ProcessStatusCode)-1
 
+// throttleAfter of a rule without a soft=
+#define NO_THROTTLE -1
+
 typedef struct registerEntry
 {
 	pid_t monitoringProcess;
 	pid_t monitoredProcess;
 	char* monitoredName;
 	unsigned long int monitorDuration;
+	int killSignal;
+	unsigned int graceSeconds;
+	bool killTree;
+	// The rule's soft=, in seconds since startingTime, or NO_THROTTLE
+	int throttleAfter;
 	time_t startingTime;
 	bool isAvailable;
+	// Sent killSignal, and waiting out the grace period
+	bool isSignalled;
+	bool isThrottled;
 	int writeToChildFD;
 	int readFromChildFD;
 	struct registerEntry* next;
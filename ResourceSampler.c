@@ -0,0 +1,952 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ResourceSampler.h"
+#include "StatFiles.h"
+#include "ProcessTree.h"
+#include "CgroupBackend.h"
+#include "Pressure.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include "memwatch.h"
+
+const char* SAMPLE_INTERVAL_ENV_VAR = "PROCNANNYSAMPLEMS";
+const char* SAMPLE_BUDGET_ENV_VAR = "PROCNANNYSAMPLEBUDGET";
+
+// Every tracked process is sampled once per interval, except for those with only CPU time budgets or idle
+// limits: those are sampled again when they could first have reached one (see getNextSampleAt), so idle
+// processes cost next to nothing however many of them are tracked. The samples are taken in
+// cycles, at most one per interval, and a cycle takes at most budget samples: the ones that have been due
+// the longest. So however many processes are tracked, a cycle costs the same, and with more of them than
+// the budget, each one is just sampled less often.
+//
+// The tracked processes are an array, indexed by an open addressing hash on pid and ordered by a binary
+// heap on when they are next due. Each scan of /proc tracks every process that matches a rule with limits
+// again, and finishTracking then drops the ones that weren't, compacting the array and rebuilding the rest.
+//
+// A process whose rule has a signal= is sent it when it goes over a limit, and stays in the heap until its
+// grace period is over, to be sent SIGKILL then. Its pidfd is in an epoll set, so that its exit is noticed
+// (and logged) as soon as it happens; see handleSamplerExits.
+//
+// With the cgroup backend, each tracked process is placed in a cgroup of its own (see CgroupBackend), which has
+// the usage of everything it has started since, and tells when the lot has exited (see noteTrackedExit). Rules
+// with a duration are then enforced here too, like any other limit (along with their soft=), instead of by worker
+// processes.
+//
+// A process over its rss> limit whose rule has reclaim gets its memory paged out instead of being killed (see
+// reclaimTrackedProcess), and is only killed if it is still over the limit at its next sample.
+//
+// Processes whose rules have a priority= are tracked even without any limits to sample, as candidate victims
+// for relievePressure.
+
+#define DEFAULT_SAMPLE_INTERVAL_MS 1000
+#define DEFAULT_SAMPLE_BUDGET 1000
+#define MINIMUM_TRACKED_CAPACITY 64
+#define NOT_OVER -1
+#define MAX_EXIT_EVENTS 64
+
+typedef struct
+{
+	pid_t pid;
+	unsigned long long startTime;
+	char* command;
+	ResourceLimits limits;
+	unsigned int lastSeen;
+	// The rule's duration, for LIMIT_WALL_TIME, counted from trackedAt
+	unsigned long int duration;
+	long long trackedAt;
+	// In a cgroup of its own
+	bool isPlaced;
+	// Past the rule's soft=, see throttleTrackedProcess
+	bool isThrottled;
+	// Paged out for being over its rss> limit, and not back under it since
+	bool isReclaiming;
+	// Exited or replaced, to be dropped; or killed, and not to be sampled again
+	bool isGone;
+	bool isKilled;
+	// Sent the rule's signal at signalledAt, and waiting out the grace period. exitFD is its pidfd, or -1.
+	bool isSignalled;
+	int exitFD;
+	long long signalledAt;
+	long long nextSampleAt;
+	long long lastSampleAt;
+	unsigned long long lastCpuTime;
+	// When lastCpuTime was first seen, for idle>. NOT_OVER before the first sample.
+	long long progressAt;
+	// Since when each limit has been exceeded, or NOT_OVER
+	long long rssOverSince;
+	long long cpuOverSince;
+} TrackedProcess;
+
+//private
+TrackedProcess* trackedProcesses = NULL;
+unsigned int trackedCount = 0;
+unsigned int trackedCapacity = 0;
+unsigned int* trackedSlots = NULL;
+unsigned int trackedSlotCapacity = 0;
+unsigned int* sampleHeap = NULL;
+unsigned int sampleHeapCount = 0;
+unsigned int trackingGeneration = 1;
+long long nextCycleAt = 0;
+int sampleInterval = 0;
+int sampleBudget = 0;
+long samplerCpuCount = 0;
+// epoll set of the exitFDs
+int exitWatchFD = -1;
+// For reportReclaimTotals
+unsigned long long reclaimedKiB = 0;
+unsigned int reclaimCount = 0;
+unsigned int killsAvoided = 0;
+
+//private
+int getSamplerSetting(const char* envVar, int defaultValue)
+{
+    const char* value = getenv(envVar);
+    int parsed = value == NULL ? 0 : atoi(value);
+    return parsed > 0 ? parsed : defaultValue;
+}
+
+//private
+bool isDueBefore(unsigned int first, unsigned int second)
+{
+    return trackedProcesses[first].nextSampleAt < trackedProcesses[second].nextSampleAt;
+}
+
+//private
+void siftUp(unsigned int position)
+{
+    while (position > 0)
+    {
+        unsigned int parent = (position - 1)/2;
+        if (!isDueBefore(sampleHeap[position], sampleHeap[parent]))
+        {
+            break;
+        }
+        unsigned int swap = sampleHeap[parent];
+        sampleHeap[parent] = sampleHeap[position];
+        sampleHeap[position] = swap;
+        position = parent;
+    }
+}
+
+//private
+void siftDown(unsigned int position)
+{
+    while (true)
+    {
+        unsigned int first = position;
+        unsigned int left = position*2 + 1;
+        unsigned int right = left + 1;
+        if (left < sampleHeapCount && isDueBefore(sampleHeap[left], sampleHeap[first]))
+        {
+            first = left;
+        }
+        if (right < sampleHeapCount && isDueBefore(sampleHeap[right], sampleHeap[first]))
+        {
+            first = right;
+        }
+        if (first == position)
+        {
+            return;
+        }
+        unsigned int swap = sampleHeap[first];
+        sampleHeap[first] = sampleHeap[position];
+        sampleHeap[position] = swap;
+        position = first;
+    }
+}
+
+//private
+void pushDue(unsigned int index)
+{
+    sampleHeap[sampleHeapCount] = index;
+    siftUp(sampleHeapCount++);
+}
+
+//private
+unsigned int popDue()
+{
+    unsigned int index = sampleHeap[0];
+    sampleHeap[0] = sampleHeap[--sampleHeapCount];
+    siftDown(0);
+    return index;
+}
+
+//private
+unsigned int* findTrackedSlot(pid_t pid)
+{
+    unsigned int mask = trackedSlotCapacity - 1;
+    unsigned int i = ((unsigned int)pid*2654435761u) & mask;
+    while (trackedSlots[i] != 0 && trackedProcesses[trackedSlots[i] - 1].pid != pid)
+    {
+        i = (i + 1) & mask;
+    }
+    return &trackedSlots[i];
+}
+
+//private
+// Rebuilds the hash and the heap from the array, leaving room for at least one more process
+bool reindexTracked(unsigned int capacity)
+{
+    LogReport report;
+    if (capacity > trackedCapacity)
+    {
+        TrackedProcess* grownTracked = (TrackedProcess*)realloc(trackedProcesses, capacity*sizeof(TrackedProcess));
+        if (!checkMallocResult(grownTracked, &report))
+        {
+            saveLogReport(report);
+            return false;
+        }
+        trackedProcesses = grownTracked;
+        unsigned int* grownHeap = (unsigned int*)realloc(sampleHeap, capacity*sizeof(unsigned int));
+        if (!checkMallocResult(grownHeap, &report))
+        {
+            saveLogReport(report);
+            return false;
+        }
+        sampleHeap = grownHeap;
+        trackedCapacity = capacity;
+    }
+
+    unsigned int newSlotCapacity = MINIMUM_TRACKED_CAPACITY;
+    while (newSlotCapacity < trackedCapacity*2)
+    {
+        newSlotCapacity *= 2;
+    }
+    if (newSlotCapacity != trackedSlotCapacity)
+    {
+        unsigned int* newSlots = (unsigned int*)malloc(newSlotCapacity*sizeof(unsigned int));
+        if (!checkMallocResult(newSlots, &report))
+        {
+            saveLogReport(report);
+            return false;
+        }
+        free(trackedSlots);
+        trackedSlots = newSlots;
+        trackedSlotCapacity = newSlotCapacity;
+    }
+    memset(trackedSlots, 0, trackedSlotCapacity*sizeof(unsigned int));
+
+    sampleHeapCount = 0;
+    unsigned int i;
+    for (i = 0; i < trackedCount; ++i)
+    {
+        *findTrackedSlot(trackedProcesses[i].pid) = i + 1;
+        if (trackedProcesses[i].isSignalled || (!trackedProcesses[i].isGone && !trackedProcesses[i].isKilled))
+        {
+            sampleHeap[sampleHeapCount++] = i;
+        }
+    }
+    for (i = sampleHeapCount/2; i-- > 0;)
+    {
+        siftDown(i);
+    }
+    return true;
+}
+
+// Starts sampling a process that matches a rule with sampled limits, or carries on with it under the
+// limits of the current rule. duration is only enforced if the limits have LIMIT_WALL_TIME. True if it
+// wasn't tracked before.
+bool trackProcess(Process* process, const ResourceLimits* limits, unsigned long int duration)
+{
+    unsigned long long startTime;
+    const char* command = getProcessCommand(process);
+    if (command == NULL || !getProcessStartTime(process, &startTime))
+    {
+        return false;
+    }
+    if (trackedCount == trackedCapacity
+        && !reindexTracked(trackedCapacity == 0 ? MINIMUM_TRACKED_CAPACITY : trackedCapacity*2))
+    {
+        return false;
+    }
+
+    unsigned int* slot = findTrackedSlot(process->pid);
+    if (*slot != 0 && trackedProcesses[*slot - 1].startTime == startTime)
+    {
+        TrackedProcess* existing = &trackedProcesses[*slot - 1];
+        bool isChanged = !hasSameLimits(&existing->limits, limits);
+        if (isChanged)
+        {
+            existing->limits = *limits;
+            existing->progressAt = NOT_OVER;
+            existing->rssOverSince = NOT_OVER;
+            existing->cpuOverSince = NOT_OVER;
+        }
+        if (isChanged || existing->duration != duration)
+        {
+            // Still counted from trackedAt
+            existing->duration = duration;
+            // It may have been put off for much longer than the new limits allow. finishTracking rebuilds
+            // the heap.
+            if (!existing->isSignalled)
+            {
+                existing->nextSampleAt = getMonotonicMillis();
+            }
+        }
+        existing->lastSeen = trackingGeneration;
+        return false;
+    }
+    if (*slot != 0)
+    {
+        // The pid was reused. The old entry stays in the heap until its turn comes, and is dropped then.
+        trackedProcesses[*slot - 1].isGone = true;
+    }
+
+    unsigned int index = trackedCount++;
+    TrackedProcess* entry = &trackedProcesses[index];
+    memset(entry, 0, sizeof(TrackedProcess));
+    entry->pid = process->pid;
+    entry->startTime = startTime;
+    entry->command = copyString((char*)command);
+    entry->limits = *limits;
+    entry->duration = duration;
+    entry->lastSeen = trackingGeneration;
+    entry->exitFD = -1;
+    entry->trackedAt = getMonotonicMillis();
+    entry->nextSampleAt = entry->trackedAt;
+    entry->lastSampleAt = NOT_OVER;
+    entry->progressAt = NOT_OVER;
+    entry->rssOverSince = NOT_OVER;
+    entry->cpuOverSince = NOT_OVER;
+    *slot = index + 1;
+    pushDue(index);
+    holdStatFile(process->pid);
+    entry->isPlaced = placeInCgroup(process->pid, startTime);
+    return true;
+}
+
+// After a scan: drops the processes that weren't tracked again in it, except for those still in their grace
+// period
+void finishTracking()
+{
+    unsigned int kept = 0;
+    unsigned int i;
+    for (i = 0; i < trackedCount; ++i)
+    {
+        if (trackedProcesses[i].isSignalled || (!trackedProcesses[i].isGone && trackedProcesses[i].lastSeen == trackingGeneration))
+        {
+            trackedProcesses[kept++] = trackedProcesses[i];
+            continue;
+        }
+        if (*findTrackedSlot(trackedProcesses[i].pid) == i + 1)
+        {
+            // Not if its pid has been taken over by a newer entry
+            releaseStatFile(trackedProcesses[i].pid);
+        }
+        if (trackedProcesses[i].isPlaced)
+        {
+            releaseCgroup(trackedProcesses[i].pid, trackedProcesses[i].startTime);
+        }
+        free(trackedProcesses[i].command);
+    }
+    trackedCount = kept;
+    ++trackingGeneration;
+    if (trackedCapacity > 0)
+    {
+        reindexTracked(trackedCapacity);
+    }
+}
+
+//private
+// False if it has exited, or been replaced by another process with the same pid
+bool isSameProcess(const TrackedProcess* entry)
+{
+    Process check;
+    initProcessQuery(&check, entry->pid, entry->command);
+    unsigned long long startTime;
+    bool isSame = getProcessStartTime(&check, &startTime) && startTime == entry->startTime;
+    clearProcessQuery(&check);
+    return isSame;
+}
+
+//private
+bool signalTrackedTarget(TrackedProcess* entry, int signal)
+{
+    if (entry->limits.killTree)
+    {
+        return signalProcessTree(entry->pid, entry->exitFD, signal);
+    }
+    return signalProcess(entry->pid, entry->exitFD, signal);
+}
+
+//private
+void watchForExit(TrackedProcess* entry)
+{
+    if (exitWatchFD < 0)
+    {
+        exitWatchFD = epoll_create1(EPOLL_CLOEXEC);
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = entry->exitFD;
+    if (exitWatchFD >= 0)
+    {
+        epoll_ctl(exitWatchFD, EPOLL_CTL_ADD, entry->exitFD, &event);
+    }
+}
+
+//private
+// The first stage of killing a process whose rule has a signal=. True if it was sent.
+bool signalTrackedProcess(TrackedProcess* entry, const char* reason, long long now)
+{
+    entry->exitFD = openProcessFD(entry->pid);
+    // Checked after opening the pidfd, so that the pidfd is known to be for the right process
+    if (!isSameProcess(entry) || !signalTrackedTarget(entry, entry->limits.signal))
+    {
+        if (entry->exitFD >= 0)
+        {
+            close(entry->exitFD);
+            entry->exitFD = -1;
+        }
+        entry->isGone = true;
+        return false;
+    }
+
+    char because[160];
+    if (reason == NULL)
+    {
+        snprintf(because, sizeof(because), "after exceeding %lu seconds", entry->duration);
+    }
+    else
+    {
+        snprintf(because, sizeof(because), "for %s", reason);
+    }
+    logSignalSent(entry->pid, entry->command, getSignalName(entry->limits.signal), because, entry->limits.graceSeconds);
+    entry->isSignalled = true;
+    entry->signalledAt = now;
+    entry->nextSampleAt = now + (long long)entry->limits.graceSeconds*1000;
+    if (entry->exitFD >= 0)
+    {
+        watchForExit(entry);
+    }
+    return true;
+}
+
+//private
+// The second stage: once the process has exited, or the grace period is over and it gets SIGKILL
+void finishSignalledProcess(TrackedProcess* entry, long long now, bool hasExited)
+{
+    const char* signalName = getSignalName(entry->limits.signal);
+    if (!hasExited)
+    {
+        hasExited = entry->exitFD >= 0 ? waitForProcessExit(entry->pid, entry->exitFD, 0) : !isSameProcess(entry);
+    }
+    if (!hasExited && signalTrackedTarget(entry, SIGKILL))
+    {
+        logGraceKill(entry->pid, entry->command, signalName, entry->limits.graceSeconds);
+    }
+    else
+    {
+        logSignalExit(entry->pid, entry->command, signalName, now - entry->signalledAt);
+    }
+
+    if (entry->exitFD >= 0)
+    {
+        // Closing it takes it out of the epoll set
+        close(entry->exitFD);
+        entry->exitFD = -1;
+    }
+    entry->isSignalled = false;
+    entry->isKilled = true;
+}
+
+//private
+// Kills it, unless it turns out to have been replaced by another process with the same pid. With a signal=,
+// only starts to; the kill is counted once it is over. A NULL reason is for running past the duration.
+bool killTrackedProcess(TrackedProcess* entry, const char* reason, long long now)
+{
+    if (entry->limits.signal != 0)
+    {
+        signalTrackedProcess(entry, reason, now);
+        return false;
+    }
+    if (!isSameProcess(entry) || !signalTrackedTarget(entry, SIGKILL))
+    {
+        entry->isGone = true;
+        return false;
+    }
+    entry->isKilled = true;
+    if (reason == NULL)
+    {
+        logProcessKill(entry->pid, entry->command, entry->duration);
+    }
+    else
+    {
+        logLimitKill(entry->pid, entry->command, reason);
+    }
+    return true;
+}
+
+//private
+// The soft= step: caps its cgroup if it has one, or lowers its priority otherwise. memory.high goes to the rss>
+// limit if there is one, or else to what it uses now.
+void throttleTrackedProcess(TrackedProcess* entry, unsigned long rss)
+{
+    const ResourceLimits* limits = &entry->limits;
+    unsigned long long memoryHigh = (limits->active & LIMIT_RSS) ? limits->rss : rss;
+    char how[96];
+    entry->isThrottled = true;
+    if (entry->isPlaced && throttleCgroup(entry->pid, entry->startTime, limits->throttleCpu, memoryHigh*1024))
+    {
+        snprintf(how, sizeof(how), "to %u percent of a CPU", limits->throttleCpu);
+    }
+    else if (reniceProcess(entry->pid, -1))
+    {
+        snprintf(how, sizeof(how), "to the lowest CPU and I/O priority");
+    }
+    else
+    {
+        return;
+    }
+    logThrottle(entry->pid, entry->command, how, limits->softSeconds);
+}
+
+//private
+// Fresh, and read the way sampleTrackedProcess reads it
+bool readTrackedRss(const TrackedProcess* entry, unsigned long* rss)
+{
+    Process process;
+    initProcessQuery(&process, entry->pid, entry->command);
+    bool isRead = getProcessUsage(&process);
+    unsigned long long cpuTime;
+    if (isRead && entry->isPlaced)
+    {
+        readCgroupUsage(entry->pid, entry->startTime, &process.rss, &cpuTime);
+    }
+    *rss = process.rss;
+    clearProcessQuery(&process);
+    return isRead;
+}
+
+//private
+// The reclaim step, for a process over its rss> limit: through memory.reclaim if it has a cgroup with one, or
+// else process_madvise. Counts how much its memory went down by. False if neither could be done, and it should
+// be killed right away.
+bool reclaimTrackedProcess(TrackedProcess* entry, unsigned long rss)
+{
+    unsigned long long excess = (unsigned long long)(rss - entry->limits.rss)*1024;
+    bool isReclaimed = entry->isPlaced && reclaimCgroup(entry->pid, entry->startTime, excess);
+    if (!isReclaimed)
+    {
+        int pidFD = openProcessFD(entry->pid);
+        // Checked after opening the pidfd, so that the pidfd is known to be for the right process
+        isReclaimed = pidFD >= 0 && isSameProcess(entry) && pageOutProcess(entry->pid, pidFD);
+        if (pidFD >= 0)
+        {
+            close(pidFD);
+        }
+    }
+    if (!isReclaimed)
+    {
+        return false;
+    }
+
+    unsigned long after = rss;
+    readTrackedRss(entry, &after);
+    unsigned long freed = after < rss ? rss - after : 0;
+    reclaimedKiB += freed;
+    ++reclaimCount;
+    entry->isReclaiming = true;
+    logReclaim(entry->pid, entry->command, freed);
+    return true;
+}
+
+//private
+bool isThrottleDue(const TrackedProcess* entry, long long now)
+{
+    const ResourceLimits* limits = &entry->limits;
+    return limits->throttleCpu != 0 && (limits->active & LIMIT_WALL_TIME) && !entry->isThrottled
+        && now - entry->trackedAt >= (long long)limits->softSeconds*1000;
+}
+
+//private
+void appendDuration(char* reason, size_t size, unsigned int seconds)
+{
+    if (seconds > 0)
+    {
+        size_t length = strlen(reason);
+        snprintf(reason + length, size - length, " for %u seconds", seconds);
+    }
+}
+
+//private
+// True if it got killed
+bool sampleTrackedProcess(TrackedProcess* entry, long long now)
+{
+    Process process;
+    initProcessQuery(&process, entry->pid, entry->command);
+    bool isRead = getProcessUsage(&process);
+    if (!isRead || (process.isStatRead && process.startTime != entry->startTime))
+    {
+        clearProcessQuery(&process);
+        entry->isGone = true;
+        return false;
+    }
+    if (entry->isPlaced)
+    {
+        readCgroupUsage(entry->pid, entry->startTime, &process.rss, &process.cpuTime);
+    }
+    if (isThrottleDue(entry, now))
+    {
+        throttleTrackedProcess(entry, process.rss);
+    }
+
+    char reason[128];
+    reason[0] = '\0';
+    const ResourceLimits* limits = &entry->limits;
+    if (limits->active & LIMIT_RSS)
+    {
+        if (process.rss <= limits->rss)
+        {
+            if (entry->isReclaiming)
+            {
+                entry->isReclaiming = false;
+                ++killsAvoided;
+                logReclaimAvoided(entry->pid, entry->command);
+            }
+            entry->rssOverSince = NOT_OVER;
+        }
+        else
+        {
+            if (entry->rssOverSince == NOT_OVER)
+            {
+                entry->rssOverSince = now;
+            }
+            bool isDue = now - entry->rssOverSince >= (long long)limits->rssSeconds*1000;
+            if (isDue && limits->reclaim && !entry->isReclaiming && reclaimTrackedProcess(entry, process.rss))
+            {
+                // Looked at again at the next sample
+                isDue = false;
+            }
+            if (isDue)
+            {
+                snprintf(reason, sizeof(reason), "using more than %llu KiB of memory", limits->rss);
+                appendDuration(reason, sizeof(reason), limits->rssSeconds);
+            }
+        }
+    }
+    if ((limits->active & LIMIT_CPU) && entry->lastSampleAt != NOT_OVER && now > entry->lastSampleAt)
+    {
+        // Over the interval since the last sample, in percent of one CPU
+        unsigned long long used = process.cpuTime > entry->lastCpuTime ? process.cpuTime - entry->lastCpuTime : 0;
+        unsigned long long percent = used/(unsigned long long)((now - entry->lastSampleAt)*10);
+        if (percent <= limits->cpu)
+        {
+            entry->cpuOverSince = NOT_OVER;
+        }
+        else
+        {
+            if (entry->cpuOverSince == NOT_OVER)
+            {
+                entry->cpuOverSince = entry->lastSampleAt;
+            }
+            if (now - entry->cpuOverSince >= (long long)limits->cpuSeconds*1000 && reason[0] == '\0')
+            {
+                snprintf(reason, sizeof(reason), "using more than %u percent of a CPU", limits->cpu);
+                appendDuration(reason, sizeof(reason), limits->cpuSeconds);
+            }
+        }
+    }
+    if ((limits->active & LIMIT_CPU_TIME) && process.cpuTime >= (unsigned long long)limits->cpuTime*1000000
+        && reason[0] == '\0')
+    {
+        snprintf(reason, sizeof(reason), "using more than %u seconds of CPU time", limits->cpuTime);
+    }
+    if (limits->active & LIMIT_IDLE)
+    {
+        if (entry->progressAt == NOT_OVER || process.cpuTime != entry->lastCpuTime)
+        {
+            entry->progressAt = now;
+        }
+        else if (now - entry->progressAt >= (long long)limits->idleSeconds*1000 && reason[0] == '\0')
+        {
+            snprintf(reason, sizeof(reason), "not using any CPU time for %u seconds", limits->idleSeconds);
+        }
+    }
+    entry->lastSampleAt = now;
+    entry->lastCpuTime = process.cpuTime;
+    clearProcessQuery(&process);
+
+    if (reason[0] == '\0' && (limits->active & LIMIT_WALL_TIME) && now - entry->trackedAt >= (long long)entry->duration*1000)
+    {
+        return killTrackedProcess(entry, NULL, now);
+    }
+    return reason[0] != '\0' && killTrackedProcess(entry, reason, now);
+}
+
+//private
+// Only rss> and cpu> need looking at every interval. A process can't use more than every CPU's worth of
+// time, so a budget with remaining seconds left can't run out in less than remaining/CPUs seconds. And a
+// process that has stayed idle since progressAt can't have been idle for long enough before progressAt
+// plus the limit. One that has just made progress is looked at again after a quarter of the limit, so
+// that it is killed at most a quarter late once it stops. A duration needs looking at once it is up, and at
+// its soft=.
+long long getNextSampleAt(const TrackedProcess* entry, long long now)
+{
+    long long next = now + sampleInterval;
+    const ResourceLimits* limits = &entry->limits;
+    if (limits->active & (LIMIT_RSS | LIMIT_CPU))
+    {
+        return next;
+    }
+
+    long long earliest = LLONG_MAX;
+    if (limits->active & LIMIT_CPU_TIME)
+    {
+        if (samplerCpuCount == 0)
+        {
+            samplerCpuCount = sysconf(_SC_NPROCESSORS_CONF);
+            samplerCpuCount = samplerCpuCount < 1 ? 1 : samplerCpuCount;
+        }
+        unsigned long long budgetMicros = (unsigned long long)limits->cpuTime*1000000;
+        unsigned long long remaining = budgetMicros > entry->lastCpuTime ? budgetMicros - entry->lastCpuTime : 0;
+        earliest = now + (long long)(remaining/1000/(unsigned long long)samplerCpuCount);
+    }
+    if (limits->active & LIMIT_IDLE)
+    {
+        long long idleMillis = (long long)limits->idleSeconds*1000;
+        long long idleAt = entry->progressAt == now ? now + idleMillis/4 : entry->progressAt + idleMillis;
+        earliest = idleAt < earliest ? idleAt : earliest;
+    }
+    if (limits->active & LIMIT_WALL_TIME)
+    {
+        long long deadline = entry->trackedAt + (long long)entry->duration*1000;
+        earliest = deadline < earliest ? deadline : earliest;
+    }
+    if (limits->throttleCpu != 0 && (limits->active & LIMIT_WALL_TIME) && !entry->isThrottled)
+    {
+        long long softAt = entry->trackedAt + (long long)limits->softSeconds*1000;
+        earliest = softAt < earliest ? softAt : earliest;
+    }
+    return earliest > next ? earliest : next;
+}
+
+// Takes the samples that are due, if a cycle is. Returns how many processes got killed.
+int sampleDueProcesses()
+{
+    long long now = getMonotonicMillis();
+    if (sampleHeapCount == 0 || now < nextCycleAt)
+    {
+        return 0;
+    }
+    if (sampleInterval == 0)
+    {
+        sampleInterval = getSamplerSetting(SAMPLE_INTERVAL_ENV_VAR, DEFAULT_SAMPLE_INTERVAL_MS);
+        sampleBudget = getSamplerSetting(SAMPLE_BUDGET_ENV_VAR, DEFAULT_SAMPLE_BUDGET);
+    }
+    nextCycleAt = now + sampleInterval;
+
+    int killed = 0;
+    int samples = 0;
+    while (sampleHeapCount > 0 && samples < sampleBudget && trackedProcesses[sampleHeap[0]].nextSampleAt <= now)
+    {
+        TrackedProcess* entry = &trackedProcesses[popDue()];
+        if (entry->isSignalled)
+        {
+            finishSignalledProcess(entry, now, false);
+            ++killed;
+            continue;
+        }
+        if (entry->isGone || entry->isKilled)
+        {
+            continue;
+        }
+        ++samples;
+        if (sampleTrackedProcess(entry, now))
+        {
+            ++killed;
+        }
+        else if (entry->isSignalled)
+        {
+            pushDue((unsigned int)(entry - trackedProcesses));
+        }
+        else if (!entry->isGone)
+        {
+            entry->nextSampleAt = getNextSampleAt(entry, now);
+            pushDue((unsigned int)(entry - trackedProcesses));
+        }
+    }
+    return killed;
+}
+
+// Readable when a process sent a signal= has exited, for handleSamplerExits. -1 if there has been none.
+int getSamplerExitFD()
+{
+    return exitWatchFD;
+}
+
+// Logs the exits of the processes sent a signal= since the last call. Returns how many there were.
+int handleSamplerExits()
+{
+    struct epoll_event events[MAX_EXIT_EVENTS];
+    int count = exitWatchFD < 0 ? 0 : epoll_wait(exitWatchFD, events, MAX_EXIT_EVENTS, 0);
+    long long now = getMonotonicMillis();
+    int finished = 0;
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        // Few processes are ever in their grace period at once, so this doesn't need an index
+        unsigned int j;
+        for (j = 0; j < trackedCount; ++j)
+        {
+            if (trackedProcesses[j].isSignalled && trackedProcesses[j].exitFD == events[i].data.fd)
+            {
+                finishSignalledProcess(&trackedProcesses[j], now, true);
+                ++finished;
+                break;
+            }
+        }
+    }
+    return finished;
+}
+
+// For handleCgroupEvents: the cgroup of a tracked process has emptied, so it has exited, along with everything
+// it started. True if that finished a kill.
+bool noteTrackedExit(pid_t pid, unsigned long long startTime)
+{
+    unsigned int* slot = trackedSlotCapacity == 0 ? NULL : findTrackedSlot(pid);
+    if (slot == NULL || *slot == 0 || trackedProcesses[*slot - 1].startTime != startTime)
+    {
+        return false;
+    }
+    TrackedProcess* entry = &trackedProcesses[*slot - 1];
+    entry->isPlaced = false;
+    if (entry->isSignalled)
+    {
+        finishSignalledProcess(entry, getMonotonicMillis(), true);
+        return true;
+    }
+    if (!entry->isGone && !entry->isKilled && (entry->limits.active & LIMIT_WALL_TIME))
+    {
+        logSelfDying(entry->pid, entry->command, entry->duration);
+    }
+    entry->isGone = true;
+    return false;
+}
+
+//private
+// Whether first should go before second to relieve memory pressure
+bool isBetterVictim(const TrackedProcess* first, unsigned long firstRss, const TrackedProcess* second,
+    unsigned long secondRss, const ScoreKey* score)
+{
+    for (; *score != SCORE_END; ++score)
+    {
+        if (*score == SCORE_PRIORITY && first->limits.priority != second->limits.priority)
+        {
+            return first->limits.priority < second->limits.priority;
+        }
+        if (*score == SCORE_RSS && firstRss != secondRss)
+        {
+            return firstRss > secondRss;
+        }
+        if (*score == SCORE_AGE && first->startTime != second->startTime)
+        {
+            return first->startTime > second->startTime;
+        }
+    }
+    return false;
+}
+
+// For a memory pressure event: kills the process that the PROCNANNYPSISCORE order puts first, among those
+// tracked for rules with a priority=. One per event; the trigger fires again if that wasn't enough. Returns how
+// many processes that killed.
+int relievePressure()
+{
+    const ScoreKey* score = getPressureScore();
+    TrackedProcess* victim = NULL;
+    unsigned long victimRss = 0;
+    unsigned int i;
+    for (i = 0; i < trackedCount; ++i)
+    {
+        TrackedProcess* entry = &trackedProcesses[i];
+        unsigned long rss;
+        if (entry->limits.priority == 0 || entry->isGone || entry->isKilled || entry->isSignalled
+            || !readTrackedRss(entry, &rss))
+        {
+            continue;
+        }
+        if (victim == NULL || isBetterVictim(entry, rss, victim, victimRss, score))
+        {
+            victim = entry;
+            victimRss = rss;
+        }
+    }
+    if (victim == NULL)
+    {
+        return 0;
+    }
+    bool isKilled = killTrackedProcess(victim, "relieving memory pressure", getMonotonicMillis());
+    // It was killed or signalled in place, out of the heap's order
+    reindexTracked(trackedCapacity);
+    return isKilled ? 1 : 0;
+}
+
+// Logs how much the reclaim step freed, and how many kills it avoided, if it was ever taken
+void reportReclaimTotals()
+{
+    if (reclaimCount > 0)
+    {
+        logReclaimReport(reclaimedKiB, reclaimCount, killsAvoided);
+    }
+}
+
+// Milliseconds until sampleDueProcesses has something to do, or -1 if nothing is tracked
+int getSamplerTimeout()
+{
+    if (sampleHeapCount == 0)
+    {
+        return -1;
+    }
+    long long dueAt = trackedProcesses[sampleHeap[0]].nextSampleAt > nextCycleAt ? trackedProcesses[sampleHeap[0]].nextSampleAt : nextCycleAt;
+    long long remaining = dueAt - getMonotonicMillis();
+    return remaining < 0 ? 0 : (int)remaining;
+}
+
+void stopSampler()
+{
+    unsigned int i;
+    for (i = 0; i < trackedCount; ++i)
+    {
+        if (trackedProcesses[i].exitFD >= 0)
+        {
+            close(trackedProcesses[i].exitFD);
+        }
+        free(trackedProcesses[i].command);
+    }
+    if (exitWatchFD >= 0)
+    {
+        close(exitWatchFD);
+        exitWatchFD = -1;
+    }
+    free(trackedProcesses);
+    free(trackedSlots);
+    free(sampleHeap);
+    trackedProcesses = NULL;
+    trackedSlots = NULL;
+    sampleHeap = NULL;
+    trackedCount = 0;
+    trackedCapacity = 0;
+    trackedSlotCapacity = 0;
+    sampleHeapCount = 0;
+}
\ No newline at end of file
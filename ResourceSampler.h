@@ -0,0 +1,36 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __RESOURCE_SAMPLER_H__
+#define __RESOURCE_SAMPLER_H__
+
+#include "Process.h"
+#include "MonitorRequest.h"
+#include <stdbool.h>
+
+// Enforces the rss>, cpu>, cputime> and idle> limits of the processes matching such rules, by sampling their usage.
+// With the cgroup backend, durations too. Also picks the victims under memory pressure.
+bool trackProcess(Process* process, const ResourceLimits* limits, unsigned long int duration);
+void finishTracking();
+int sampleDueProcesses();
+int getSamplerExitFD();
+int handleSamplerExits();
+bool noteTrackedExit(pid_t pid, unsigned long long startTime);
+int relievePressure();
+int getSamplerTimeout();
+void reportReclaimTotals();
+void stopSampler();
+#endif
\ No newline at end of file
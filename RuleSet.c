@@ -0,0 +1,1019 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "RuleSet.h"
+#include "Utils.h"
+#include "PatternCompiler.h"
+#include "Process.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include "memwatch.h"
+
+// Rule sets are built on the config compiler thread, so nothing in here may use malloc. See ConfigCompiler.c.
+
+#define MINIMUM_HASH_CAPACITY 16
+#define MAX_CGROUP_DEPTH 64
+#define EMPTY_SLOT 0
+
+//private
+size_t alignUp(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+//private
+unsigned int hashName(const char* name, int length)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    int i;
+    for (i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//private
+unsigned int* getHashSlots(const RuleSet* this)
+{
+    return (unsigned int*)((char*)this + this->hashOffset);
+}
+
+//private
+char* getNames(const RuleSet* this)
+{
+    return (char*)this + this->namesOffset;
+}
+
+//private
+CommKey* getCommKeys(const RuleSet* this)
+{
+    return (CommKey*)((char*)this + this->commKeysOffset);
+}
+
+//private
+uid_t* getUids(const RuleSet* this)
+{
+    return (uid_t*)((char*)this + this->uidsOffset);
+}
+
+//private
+ExeIdentity* getExeIdentities(const RuleSet* this)
+{
+    return (ExeIdentity*)((char*)this + this->exeIdentitiesOffset);
+}
+
+//private
+CgroupNode* getCgroupNodes(const RuleSet* this)
+{
+    return (CgroupNode*)((char*)this + this->cgroupNodesOffset);
+}
+
+//private
+unsigned int* getCgroupEdges(const RuleSet* this)
+{
+    return (unsigned int*)((char*)this + this->cgroupEdgesOffset);
+}
+
+//private
+unsigned int getHashCapacity(unsigned int count)
+{
+    // Load factor at most 1/2
+    unsigned int capacity = MINIMUM_HASH_CAPACITY;
+    while (capacity < count*2)
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+RuleSet* allocateRuleSet(const RuleSetSizes* sizes)
+{
+    // Big enough for commSlots too, which can have a comm for every argv= word as well as every request
+    unsigned int hashCapacity = getHashCapacity(sizes->requestCount + sizes->argvWordCount);
+    // Plus the root
+    unsigned int cgroupNodeCapacity = sizes->cgroupComponentCount + 1;
+    unsigned int cgroupEdgeCapacity = getHashCapacity(cgroupNodeCapacity);
+
+    size_t requestsOffset = alignUp(sizeof(RuleSet));
+    size_t hashOffset = alignUp(requestsOffset + sizes->requestCount*sizeof(MonitorRequest));
+    size_t commSlotsOffset = alignUp(hashOffset + hashCapacity*sizeof(unsigned int));
+    size_t commKeysOffset = alignUp(commSlotsOffset + hashCapacity*sizeof(unsigned int));
+    unsigned int commKeyCount = sizes->requestCount + sizes->argvWordCount;
+    unsigned int commKeyCapacity = commKeyCount < MAX_SIMD_COMM_KEYS ? commKeyCount : MAX_SIMD_COMM_KEYS;
+    size_t uidsOffset = alignUp(commKeysOffset + commKeyCapacity*sizeof(CommKey));
+    size_t exeIdentitiesOffset = alignUp(uidsOffset + sizes->uidRequestCount*sizeof(uid_t));
+    size_t cgroupNodesOffset = alignUp(exeIdentitiesOffset + sizes->exeRequestCount*sizeof(ExeIdentity));
+    size_t cgroupEdgesOffset = alignUp(cgroupNodesOffset + cgroupNodeCapacity*sizeof(CgroupNode));
+    size_t dfaOffset = alignUp(cgroupEdgesOffset + cgroupEdgeCapacity*sizeof(unsigned int));
+    size_t namesOffset = alignUp(dfaOffset + sizes->dfaSize);
+    size_t size = namesOffset + sizes->namesSize;
+
+    // Anonymous mappings come zeroed, which is an empty hash table
+    RuleSet* this = (RuleSet*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (this == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    this->magic = RULESET_MAGIC;
+    this->version = RULESET_VERSION;
+    this->headerSize = sizeof(RuleSet);
+    this->requestSize = sizeof(MonitorRequest);
+    this->size = size;
+    this->hashCapacity = hashCapacity;
+    this->requestsOffset = requestsOffset;
+    this->hashOffset = hashOffset;
+    this->commSlotsOffset = commSlotsOffset;
+    this->commKeysOffset = commKeysOffset;
+    this->uidsOffset = uidsOffset;
+    this->exeIdentitiesOffset = exeIdentitiesOffset;
+    this->cgroupNodesOffset = cgroupNodesOffset;
+    this->cgroupNodeCount = 1;
+    this->cgroupEdgesOffset = cgroupEdgesOffset;
+    this->cgroupEdgeCapacity = cgroupEdgeCapacity;
+    this->dfaOffset = dfaOffset;
+    this->dfaSize = sizes->dfaSize;
+    this->namesOffset = namesOffset;
+    return this;
+}
+
+void destroyRuleSet(RuleSet* this)
+{
+    if (this != NULL)
+    {
+        munmap(this, this->size);
+    }
+}
+
+bool isRuleSetImage(const void* data, size_t size)
+{
+    return size >= sizeof(unsigned int) && *(const unsigned int*)data == RULESET_MAGIC;
+}
+
+//private
+// Only the layout is checked, which is O(1). The contents are trusted to come from procnanny-compile.
+bool isRuleSetImageValid(const RuleSet* this, size_t fileSize)
+{
+    if (fileSize < sizeof(RuleSet) || this->magic != RULESET_MAGIC || this->version != RULESET_VERSION
+        || this->headerSize != sizeof(RuleSet) || this->requestSize != sizeof(MonitorRequest) || this->size != fileSize)
+    {
+        return false;
+    }
+    if (this->hashCapacity == 0 || (this->hashCapacity & (this->hashCapacity - 1)) != 0
+        || this->hashCapacity < this->requestCount)
+    {
+        return false;
+    }
+    return this->requestsOffset >= sizeof(RuleSet)
+        && this->hashOffset >= this->requestsOffset + this->requestCount*sizeof(MonitorRequest)
+        && this->commSlotsOffset >= this->hashOffset + this->hashCapacity*sizeof(unsigned int)
+        && this->commKeysOffset >= this->commSlotsOffset + this->hashCapacity*sizeof(unsigned int)
+        && this->uidsOffset >= this->commKeysOffset
+            + (this->commCount < MAX_SIMD_COMM_KEYS ? this->commCount : MAX_SIMD_COMM_KEYS)*sizeof(CommKey)
+        && this->exeIdentitiesOffset >= this->uidsOffset + this->uidCount*sizeof(uid_t)
+        && this->cgroupNodesOffset >= this->exeIdentitiesOffset + this->exeCount*sizeof(ExeIdentity)
+        && this->cgroupEdgeCapacity > 0 && (this->cgroupEdgeCapacity & (this->cgroupEdgeCapacity - 1)) == 0
+        && this->cgroupEdgesOffset >= this->cgroupNodesOffset + this->cgroupNodeCount*sizeof(CgroupNode)
+        && this->dfaOffset >= this->cgroupEdgesOffset + this->cgroupEdgeCapacity*sizeof(unsigned int)
+        && this->namesOffset >= this->dfaOffset + this->dfaSize
+        && this->namesOffset + this->namesUsed <= this->size;
+}
+
+// Maps a compiled image. It is private and writable only so that the per-load fields of the header can
+// be filled in; the rest of it is never written, so it stays shared with the page cache.
+RuleSet* loadRuleSetImage(const char* path, LogReport* report)
+{
+    long long started = getMonotonicMillis();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        report->message = "Failed to open file.";
+        report->type = ERROR;
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        close(fd);
+        report->message = "Failed to stat file.";
+        report->type = ERROR;
+        return NULL;
+    }
+
+    RuleSet* this = NULL;
+    if ((size_t)info.st_size >= sizeof(RuleSet))
+    {
+        this = (RuleSet*)mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (this == NULL || this == MAP_FAILED)
+    {
+        report->message = "Failed to map the compiled rule set.";
+        report->type = ERROR;
+        return NULL;
+    }
+
+    if (!isRuleSetImageValid(this, (size_t)info.st_size))
+    {
+        munmap(this, info.st_size);
+        report->message = "Compiled rule set is corrupt, or from another version of procnanny-compile.";
+        report->type = ERROR;
+        return NULL;
+    }
+
+    this->isPrecompiled = true;
+    this->added = 0;
+    this->removed = 0;
+    this->changed = 0;
+    this->ignoredLines = 0;
+    this->unresolvedRules = 0;
+    this->compileMillis = getMonotonicMillis() - started;
+    return this;
+}
+
+// Written to a temporary file first and renamed over path, so a running procnanny never maps a partial image
+bool saveRuleSetImage(RuleSet* this, const char* path, LogReport* report)
+{
+    char temporaryPath[4096];
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path);
+    int fd = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        report->message = "Failed to create the compiled rule set.";
+        report->type = ERROR;
+        return false;
+    }
+
+    // Nothing about how this set was built belongs in the image
+    unsigned int i;
+    for (i = 0; i < this->requestCount; ++i)
+    {
+        getMonitorRequest(this, i)->isNew = false;
+    }
+    this->isPrecompiled = false;
+    this->added = 0;
+    this->removed = 0;
+    this->changed = 0;
+    this->ignoredLines = 0;
+    this->unresolvedRules = 0;
+    this->compileMillis = 0;
+
+    const char* data = (const char*)this;
+    size_t written = 0;
+    while (written < this->size)
+    {
+        ssize_t result = write(fd, data + written, this->size - written);
+        if (result <= 0)
+        {
+            break;
+        }
+        written += result;
+    }
+
+    if (written != this->size || fsync(fd) < 0 || close(fd) < 0 || rename(temporaryPath, path) < 0)
+    {
+        unlink(temporaryPath);
+        report->message = "Failed to write the compiled rule set.";
+        report->type = ERROR;
+        return false;
+    }
+    return true;
+}
+
+MonitorRequest* getMonitorRequest(const RuleSet* this, unsigned int index)
+{
+    return (MonitorRequest*)((char*)this + this->requestsOffset) + index;
+}
+
+void* getPatternDFA(const RuleSet* this)
+{
+    return (char*)this + this->dfaOffset;
+}
+
+const char* getProcessName(const RuleSet* this, const MonitorRequest* request)
+{
+    return getNames(this) + request->processNameOffset;
+}
+
+//private
+// Copies length bytes of text and a NUL into the names, returning where they went
+unsigned int addName(RuleSet* this, const char* text, int length)
+{
+    char* names = getNames(this);
+    unsigned int offset = (unsigned int)this->namesUsed;
+    memcpy(names + offset, text, length);
+    names[offset + length] = '\0';
+    this->namesUsed += length + 1;
+    return offset;
+}
+
+//private
+bool hasSamePredicates(const RuleSet* this, const MonitorRequest* request, const RuleSet* other, const MonitorRequest* otherRequest)
+{
+    if (request->predicates != otherRequest->predicates || request->kind != otherRequest->kind)
+    {
+        return false;
+    }
+    if ((request->predicates & PREDICATE_UID) && request->uid != otherRequest->uid)
+    {
+        return false;
+    }
+    if ((request->predicates & PREDICATE_PARENT)
+        && !compareStrings(getNames(this) + request->parentNameOffset, getNames(other) + otherRequest->parentNameOffset))
+    {
+        return false;
+    }
+    if (request->argvCount != otherRequest->argvCount)
+    {
+        return false;
+    }
+    const char* token = getNames(this) + request->argvOffset;
+    const char* otherToken = getNames(other) + otherRequest->argvOffset;
+    unsigned int i;
+    for (i = 0; i < request->argvCount; ++i)
+    {
+        if (!compareStrings(token, otherToken))
+        {
+            return false;
+        }
+        token += strlen(token) + 1;
+        otherToken += strlen(otherToken) + 1;
+    }
+    return true;
+}
+
+//private
+unsigned int hashCgroupEdge(unsigned int parent, const char* component, int length)
+{
+    return hashName(component, length) ^ (parent*2654435761u);
+}
+
+//private
+// The slot for the edge from parent through component: either the child's index + 1, or empty
+unsigned int* findCgroupEdge(const RuleSet* this, unsigned int parent, const char* component, int length)
+{
+    unsigned int* edges = getCgroupEdges(this);
+    const CgroupNode* nodes = getCgroupNodes(this);
+    unsigned int mask = this->cgroupEdgeCapacity - 1;
+    unsigned int i = hashCgroupEdge(parent, component, length) & mask;
+    while (edges[i] != EMPTY_SLOT)
+    {
+        const CgroupNode* child = &nodes[edges[i] - 1];
+        if (child->parent == parent && child->componentLength == (unsigned int)length
+            && memcmp(getNames(this) + child->componentOffset, component, length) == 0)
+        {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &edges[i];
+}
+
+//private
+// The next non empty component of path at or after *position, or 0 length when there are none left
+int getNextComponent(const char* path, int pathLength, int* position)
+{
+    while (*position < pathLength && path[*position] == '/')
+    {
+        ++*position;
+    }
+    int length = 0;
+    while (*position + length < pathLength && path[*position + length] != '/')
+    {
+        ++length;
+    }
+    return length;
+}
+
+//private
+// Walks (and grows) the trie down the request's path. Its first request marks the node; the others
+// for the same path are its alternatives.
+void addCgroupRequest(RuleSet* this, const MonitorRequest* request, unsigned int index)
+{
+    const char* path = getProcessName(this, request) + strlen(CGROUP_PREFIX);
+    int pathLength = (int)request->processNameLength - strlen(CGROUP_PREFIX);
+    unsigned int node = 0;
+    int position = 0;
+    int length;
+    while ((length = getNextComponent(path, pathLength, &position)) > 0)
+    {
+        unsigned int* edge = findCgroupEdge(this, node, path + position, length);
+        if (*edge == EMPTY_SLOT)
+        {
+            CgroupNode* child = &getCgroupNodes(this)[this->cgroupNodeCount];
+            child->parent = node;
+            child->componentOffset = (unsigned int)(path + position - getNames(this));
+            child->componentLength = (unsigned int)length;
+            *edge = ++this->cgroupNodeCount;
+        }
+        node = *edge - 1;
+        position += length;
+    }
+
+    CgroupNode* target = &getCgroupNodes(this)[node];
+    if (target->request == 0)
+    {
+        target->request = index + 1;
+    }
+}
+
+//private
+// The slot holding the comm key, or the empty slot where it would go. Slots hold where in the names (plus one)
+// the word that the comm comes from is.
+unsigned int* findCommSlot(const RuleSet* this, const char* key, int keyLength)
+{
+    unsigned int* slots = (unsigned int*)((char*)this + this->commSlotsOffset);
+    unsigned int mask = this->hashCapacity - 1;
+    unsigned int i = hashName(key, keyLength) & mask;
+    while (slots[i] != EMPTY_SLOT)
+    {
+        int length;
+        const char* existing = getCommKey(getNames(this) + slots[i] - 1, &length);
+        if (length == keyLength && memcmp(existing, key, length) == 0)
+        {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+//private
+void addCommKey(RuleSet* this, unsigned int nameOffset)
+{
+    int length;
+    const char* key = getCommKey(getNames(this) + nameOffset, &length);
+    unsigned int* slot = findCommSlot(this, key, length);
+    if (*slot == EMPTY_SLOT)
+    {
+        *slot = nameOffset + 1;
+        if (this->commCount < MAX_SIMD_COMM_KEYS)
+        {
+            makeCommKey(getCommKeys(this) + this->commCount, key, length);
+        }
+        this->commCount++;
+    }
+}
+
+//private
+// The comm of the name, and those of its argv= words, in case one of them is a script run through its #! line
+void addCommKeys(RuleSet* this, const MonitorRequest* request)
+{
+    addCommKey(this, request->processNameOffset);
+    unsigned int offset = request->argvOffset;
+    unsigned int i;
+    for (i = 0; i < request->argvCount; ++i)
+    {
+        addCommKey(this, offset);
+        offset += strlen(getNames(this) + offset) + 1;
+    }
+}
+
+// A ProcessFilter for getRunningProcesses: whether a process with this comm could match any rule in the set.
+// Only exact names say anything about the comm, so any other kind of rule lets every process through.
+bool isCommCandidate(const char* comm, const void* set)
+{
+    const RuleSet* this = (const RuleSet*)set;
+    if (this->dfaSize > 0 || this->exeCount > 0 || this->cgroupNodeCount > 1 || getCgroupNodes(this)->request != 0)
+    {
+        return true;
+    }
+    int length = strlen(comm);
+    if (this->commCount <= MAX_SIMD_COMM_KEYS)
+    {
+        CommKey key;
+        makeCommKey(&key, comm, length);
+        return containsCommKey(getCommKeys(this), this->commCount, &key);
+    }
+    return *findCommSlot(this, comm, length) != EMPTY_SLOT;
+}
+
+// Appends a request. A later request for the same name and predicates replaces the earlier one, keeping
+// its place among the alternatives for that name.
+MonitorRequest* addMonitorRequest(RuleSet* this, RequestKind kind, const char* name, int nameLength, unsigned long int duration,
+    const RequestPredicates* predicates)
+{
+    unsigned int index = this->requestCount++;
+    MonitorRequest* request = getMonitorRequest(this, index);
+    request->kind = kind;
+    request->processNameOffset = addName(this, name, nameLength);
+    request->processNameLength = (unsigned int)nameLength;
+    request->monitorDuration = duration;
+    request->predicates = predicates->predicates;
+    request->uid = predicates->uid;
+    request->argvOffset = (unsigned int)this->namesUsed;
+    request->argvCount = (unsigned int)predicates->argvCount;
+    int i;
+    for (i = 0; i < predicates->argvCount; ++i)
+    {
+        addName(this, predicates->argv[i], predicates->argvLength[i]);
+    }
+    if (request->predicates & PREDICATE_PARENT)
+    {
+        request->parentNameOffset = addName(this, predicates->parentName, predicates->parentNameLength);
+    }
+    if (request->predicates & PREDICATE_ARGV)
+    {
+        this->argvRequestCount++;
+    }
+
+    unsigned int* slots = getHashSlots(this);
+    unsigned int mask = this->hashCapacity - 1;
+    unsigned int slot = hashName(name, nameLength) & mask;
+    while (slots[slot] != EMPTY_SLOT)
+    {
+        MonitorRequest* existing = getMonitorRequest(this, slots[slot] - 1);
+        if (compareStrings(getProcessName(this, existing), getProcessName(this, request)))
+        {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    unsigned int* link = &slots[slot];
+    while (*link != EMPTY_SLOT)
+    {
+        MonitorRequest* existing = getMonitorRequest(this, *link - 1);
+        if (hasSamePredicates(this, existing, this, request))
+        {
+            existing->isDuplicate = true;
+            request->nextAlternative = existing->nextAlternative;
+            *link = index + 1;
+            return request;
+        }
+        link = &existing->nextAlternative;
+    }
+    *link = index + 1;
+    this->uniqueCount++;
+    if (kind == CGROUP_PATH)
+    {
+        addCgroupRequest(this, request, index);
+    }
+    if (kind == EXACT_NAME)
+    {
+        addCommKeys(this, request);
+    }
+    return request;
+}
+
+//private
+// The first of the alternatives for the name, or NULL
+MonitorRequest* findFirstAlternative(const RuleSet* this, const char* name, int nameLength)
+{
+    unsigned int* slots = getHashSlots(this);
+    unsigned int mask = this->hashCapacity - 1;
+    unsigned int i = hashName(name, nameLength) & mask;
+    while (slots[i] != EMPTY_SLOT)
+    {
+        MonitorRequest* request = getMonitorRequest(this, slots[i] - 1);
+        if (request->processNameLength == (unsigned int)nameLength
+            && memcmp(getProcessName(this, request), name, nameLength) == 0)
+        {
+            return request;
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+//private
+MonitorRequest* getNextAlternative(const RuleSet* this, const MonitorRequest* request)
+{
+    return request->nextAlternative == 0 ? NULL : getMonitorRequest(this, request->nextAlternative - 1);
+}
+
+// The request written exactly as name in the config (the first one, if it has alternatives), whatever its kind
+MonitorRequest* findRequestByName(const RuleSet* this, const char* name)
+{
+    return findFirstAlternative(this, name, strlen(name));
+}
+
+// The request in this set for the same name and predicates as request, which is from other
+MonitorRequest* findEquivalentRequest(const RuleSet* this, const RuleSet* other, const MonitorRequest* request)
+{
+    MonitorRequest* candidate = findFirstAlternative(this, getProcessName(other, request), request->processNameLength);
+    for (; candidate != NULL; candidate = getNextAlternative(this, candidate))
+    {
+        if (hasSamePredicates(this, candidate, other, request))
+        {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+//private
+bool isUidInIndex(const RuleSet* this, uid_t uid)
+{
+    const uid_t* uids = getUids(this);
+    unsigned int low = 0;
+    unsigned int high = this->uidCount;
+    while (low < high)
+    {
+        unsigned int middle = low + (high - low)/2;
+        if (uids[middle] < uid)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low < this->uidCount && uids[low] == uid;
+}
+
+//private
+// Whether one of the words after the first in command is exactly token
+bool hasArgument(const char* command, const char* token)
+{
+    size_t tokenLength = strlen(token);
+    const char* word = strchr(command, ' ');
+    while (word != NULL)
+    {
+        ++word;
+        const char* wordEnd = strchr(word, ' ');
+        size_t wordLength = wordEnd == NULL ? strlen(word) : (size_t)(wordEnd - word);
+        if (wordLength == tokenLength && memcmp(word, token, tokenLength) == 0)
+        {
+            return true;
+        }
+        word = wordEnd;
+    }
+    return false;
+}
+
+//private
+// Cheapest first: an integer, then the command already in hand, then reads from /proc
+bool matchesPredicates(const RuleSet* this, const MonitorRequest* request, Process* process)
+{
+    if (request->predicates & PREDICATE_UID)
+    {
+        uid_t uid;
+        if (!getProcessUid(process, &uid) || uid != request->uid)
+        {
+            return false;
+        }
+    }
+
+    const char* token = getNames(this) + request->argvOffset;
+    unsigned int i;
+    for (i = 0; i < request->argvCount; ++i)
+    {
+        if (!hasArgument(getProcessCommand(process), token))
+        {
+            return false;
+        }
+        token += strlen(token) + 1;
+    }
+
+    if (request->predicates & PREDICATE_PARENT)
+    {
+        const char* parentName = getProcessParentName(process);
+        if (parentName == NULL || !compareStrings(parentName, getNames(this) + request->parentNameOffset))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//private
+// The first alternative for name, among those with argv predicates or those without, that process meets
+MonitorRequest* findMatchingAlternative(const RuleSet* this, const char* name, int nameLength, Process* process, bool withArgv)
+{
+    MonitorRequest* request = findFirstAlternative(this, name, nameLength);
+    for (; request != NULL; request = getNextAlternative(this, request))
+    {
+        if (request->kind == EXACT_NAME && ((request->predicates & PREDICATE_ARGV) != 0) == withArgv
+            && matchesPredicates(this, request, process))
+        {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+//private
+int compareExeIdentity(const ExeIdentity* identity, dev_t device, ino_t inode)
+{
+    if (identity->device != device)
+    {
+        return identity->device < device ? -1 : 1;
+    }
+    if (identity->inode != inode)
+    {
+        return identity->inode < inode ? -1 : 1;
+    }
+    return 0;
+}
+
+//private
+// The first exe: request, in config order, for the file process is running that process meets
+MonitorRequest* findExeRequest(const RuleSet* this, Process* process)
+{
+    dev_t device;
+    ino_t inode;
+    if (!getProcessExe(process, &device, &inode))
+    {
+        return NULL;
+    }
+
+    const ExeIdentity* identities = getExeIdentities(this);
+    unsigned int low = 0;
+    unsigned int high = this->exeCount;
+    while (low < high)
+    {
+        unsigned int middle = low + (high - low)/2;
+        if (compareExeIdentity(&identities[middle], device, inode) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for (; low < this->exeCount && compareExeIdentity(&identities[low], device, inode) == 0; ++low)
+    {
+        MonitorRequest* request = getMonitorRequest(this, identities[low].requestIndex);
+        if (matchesPredicates(this, request, process))
+        {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+//private
+// The cgroup: request for the deepest prefix of the process's cgroup that process meets
+MonitorRequest* findCgroupRequest(const RuleSet* this, Process* process)
+{
+    const char* path = getProcessCgroup(process);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    unsigned int matched[MAX_CGROUP_DEPTH];
+    int depth = 0;
+    const CgroupNode* nodes = getCgroupNodes(this);
+    unsigned int node = 0;
+    if (nodes[0].request != 0)
+    {
+        matched[depth++] = 0;
+    }
+
+    int pathLength = strlen(path);
+    int position = 0;
+    int length;
+    while (depth < MAX_CGROUP_DEPTH && (length = getNextComponent(path, pathLength, &position)) > 0)
+    {
+        unsigned int edge = *findCgroupEdge(this, node, path + position, length);
+        if (edge == EMPTY_SLOT)
+        {
+            break;
+        }
+        node = edge - 1;
+        position += length;
+        if (nodes[node].request != 0)
+        {
+            matched[depth++] = node;
+        }
+    }
+
+    while (depth > 0)
+    {
+        const MonitorRequest* marker = getMonitorRequest(this, nodes[matched[--depth]].request - 1);
+        MonitorRequest* request = findFirstAlternative(this, getProcessName(this, marker), marker->processNameLength);
+        for (; request != NULL; request = getNextAlternative(this, request))
+        {
+            if (matchesPredicates(this, request, process))
+            {
+                return request;
+            }
+        }
+    }
+    return NULL;
+}
+
+// The request monitoring process: an exact name if there is one, else an exe: rule for the file it runs,
+// else a cgroup: rule for the deepest prefix of its cgroup, else the first matching pattern. Exact names
+// with argv predicates match the first word of the command, everything else matches the whole command.
+MonitorRequest* findMonitorRequest(const RuleSet* this, Process* process)
+{
+    // A process whose uid no rule names can only match the rules without one, so the kinds of rules that all
+    // name a uid are skipped for it. When every rule names one, that turns it away before any string work.
+    unsigned int kinds = ~0u;
+    if (this->uidCount > 0)
+    {
+        uid_t uid;
+        if (!getProcessUid(process, &uid) || !isUidInIndex(this, uid))
+        {
+            kinds = this->uidlessKinds;
+        }
+        if (kinds == 0)
+        {
+            return NULL;
+        }
+    }
+
+    const char* command = getProcessCommand(process);
+    if (command == NULL)
+    {
+        // Gone
+        return NULL;
+    }
+    MonitorRequest* request = NULL;
+    if (kinds & (1u << EXACT_NAME))
+    {
+        request = findMatchingAlternative(this, command, strlen(command), process, false);
+    }
+    if (request != NULL)
+    {
+        return request;
+    }
+
+    const char* space = strchr(command, ' ');
+    if (this->argvRequestCount > 0 && space != NULL && (kinds & (1u << EXACT_NAME)))
+    {
+        request = findMatchingAlternative(this, command, (int)(space - command), process, true);
+        if (request != NULL)
+        {
+            return request;
+        }
+    }
+
+    if (this->exeCount > 0 && (kinds & (1u << EXE_PATH)))
+    {
+        request = findExeRequest(this, process);
+        if (request != NULL)
+        {
+            return request;
+        }
+    }
+
+    if ((this->cgroupNodeCount > 1 || getCgroupNodes(this)->request != 0) && (kinds & (1u << CGROUP_PATH)))
+    {
+        request = findCgroupRequest(this, process);
+        if (request != NULL)
+        {
+            return request;
+        }
+    }
+
+    if (this->dfaSize == 0 || !(kinds & ((1u << GLOB_PATTERN) | (1u << REGEX_PATTERN))))
+    {
+        return NULL;
+    }
+    int count;
+    const int* matches = matchPatternDFA(getPatternDFA(this), command, &count);
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        request = getMonitorRequest(this, (unsigned int)matches[i]);
+        if (request->isDuplicate)
+        {
+            // The same pattern and predicates are listed again later, and that one wins
+            request = findEquivalentRequest(this, this, request);
+        }
+        if (matchesPredicates(this, request, process))
+        {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+//private
+bool isExeIdentityBefore(const ExeIdentity* first, const ExeIdentity* second)
+{
+    int order = compareExeIdentity(first, second->device, second->inode);
+    return order < 0 || (order == 0 && first->requestIndex < second->requestIndex);
+}
+
+//private
+void sortExeIdentities(ExeIdentity* identities, unsigned int count)
+{
+    // Shell sort, like sortUids
+    unsigned int gap;
+    for (gap = count/2; gap > 0; gap /= 2)
+    {
+        unsigned int i;
+        for (i = gap; i < count; ++i)
+        {
+            ExeIdentity value = identities[i];
+            unsigned int j;
+            for (j = i; j >= gap && isExeIdentityBefore(&value, &identities[j - gap]); j -= gap)
+            {
+                identities[j] = identities[j - gap];
+            }
+            identities[j] = value;
+        }
+    }
+}
+
+//private
+void sortUids(uid_t* uids, unsigned int count)
+{
+    // Shell sort, since this runs on the config compiler thread (no qsort scratch allocations)
+    unsigned int gap;
+    for (gap = count/2; gap > 0; gap /= 2)
+    {
+        unsigned int i;
+        for (i = gap; i < count; ++i)
+        {
+            uid_t value = uids[i];
+            unsigned int j;
+            for (j = i; j >= gap && uids[j - gap] > value; j -= gap)
+            {
+                uids[j] = uids[j - gap];
+            }
+            uids[j] = value;
+        }
+    }
+}
+
+// Builds the uid index, and diffs the finished set against base (which may be NULL), flagging what is new
+void finishRuleSet(RuleSet* this, const RuleSet* base)
+{
+    unsigned int i;
+    int unchanged = 0;
+    uid_t* uids = getUids(this);
+    unsigned int uidRequestCount = 0;
+    for (i = 0; i < this->requestCount; ++i)
+    {
+        MonitorRequest* request = getMonitorRequest(this, i);
+        if (request->isDuplicate)
+        {
+            continue;
+        }
+
+        if (request->predicates & PREDICATE_UID)
+        {
+            uids[uidRequestCount++] = request->uid;
+        }
+        else
+        {
+            this->uidlessKinds |= 1u << request->kind;
+        }
+        if (request->kind == EXE_PATH && request->exeInode != 0)
+        {
+            ExeIdentity* identity = &getExeIdentities(this)[this->exeCount++];
+            identity->device = request->exeDevice;
+            identity->inode = request->exeInode;
+            identity->requestIndex = i;
+        }
+
+        MonitorRequest* old = base == NULL ? NULL : findEquivalentRequest(base, this, request);
+        if (old == NULL)
+        {
+            request->isNew = true;
+            this->added++;
+        }
+        else if (old->monitorDuration != request->monitorDuration || !hasSameLimits(&old->limits, &request->limits))
+        {
+            request->isNew = true;
+            this->changed++;
+        }
+        else
+        {
+            ++unchanged;
+        }
+    }
+    this->removed = (base == NULL ? 0 : (int)base->uniqueCount) - this->changed - unchanged;
+
+    // uidCount ends up counting the distinct uids. See findMonitorRequest.
+    sortExeIdentities(getExeIdentities(this), this->exeCount);
+    sortUids(uids, uidRequestCount);
+    this->uidCount = 0;
+    for (i = 0; i < uidRequestCount; ++i)
+    {
+        if (this->uidCount == 0 || uids[this->uidCount - 1] != uids[i])
+        {
+            uids[this->uidCount++] = uids[i];
+        }
+    }
+    this->uidRequestCount = uidRequestCount;
+}
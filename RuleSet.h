@@ -0,0 +1,142 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __RULE_SET_H__
+#define __RULE_SET_H__
+
+#include "MonitorRequest.h"
+#include "Logging.h"
+#include "Process.h"
+#include "CommMatcher.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+// A compiled config. It is one contiguous, position independent block of memory (only offsets, no
+// pointers) and is never modified once built, so it can be shared between threads without locks.
+//
+// Layout: RuleSet | MonitorRequest[requestCount] | unsigned int hashSlots[hashCapacity]
+//     | unsigned int commSlots[hashCapacity] | CommKey commKeys[min(commCount, MAX_SIMD_COMM_KEYS)]
+//     | uid_t uids[uidCount] | ExeIdentity exeIdentities[exeCount] | CgroupNode cgroupNodes[cgroupNodeCount]
+//     | unsigned int cgroupEdges[cgroupEdgeCapacity] | pattern DFA | names
+//
+// Every request is in the hash table, under its name as written in the config, but only exact names match
+// processes through it. Requests for the same name with different predicates hang off the same slot as a
+// list of alternatives. Glob and regex requests match through the DFA built by PatternCompiler. uids is
+// the sorted set of uids that rules ask for, and exeIdentities the exe: requests sorted by the file they name.
+// The cgroup: requests form a trie of path components, whose edges are a hash table on (parent, component).
+// commSlots is a hash set of the comms that processes matching the exact names would have, which lets the
+// process scan skip everything else when there are no other kinds of rules. A rule with argv= words adds theirs
+// too, as a script run through its #! line is named after the script, while its first word is the interpreter.
+// When there are few enough of them, they are also packed into commKeys for a SIMD scan, faster than hashing.
+//
+// procnanny-compile writes this block out as is, and procnanny maps such an image back and uses it in place.
+// RULESET_VERSION must change whenever anything in the layout (including MonitorRequest) does.
+#define RULESET_MAGIC 0x53524e50u
+#define RULESET_VERSION 17
+
+typedef struct
+{
+	dev_t device;
+	ino_t inode;
+	unsigned int requestIndex;
+} ExeIdentity;
+
+typedef struct
+{
+	unsigned int parent;
+	// The component is in the name of a request that goes through this node
+	unsigned int componentOffset;
+	unsigned int componentLength;
+	// Index + 1 of a cgroup: request for exactly this path. 0 if none.
+	unsigned int request;
+} CgroupNode;
+
+// How much room allocateRuleSet has to leave for each part of a set
+typedef struct
+{
+	unsigned int requestCount;
+	size_t namesSize;
+	size_t dfaSize;
+	// argv= words over all requests
+	unsigned int argvWordCount;
+	// Requests with a uid predicate, and exe: requests
+	unsigned int uidRequestCount;
+	unsigned int exeRequestCount;
+	// Path components over all cgroup: requests
+	unsigned int cgroupComponentCount;
+} RuleSetSizes;
+
+typedef struct ruleSet
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int headerSize;
+	unsigned int requestSize;
+	size_t size;
+	unsigned int requestCount;
+	unsigned int uniqueCount;
+	unsigned int hashCapacity;
+	size_t requestsOffset;
+	size_t hashOffset;
+	size_t commSlotsOffset;
+	size_t commKeysOffset;
+	// Distinct comms of the exact names. commKeys only holds them all if this is at most MAX_SIMD_COMM_KEYS.
+	unsigned int commCount;
+	size_t uidsOffset;
+	unsigned int uidCount;
+	unsigned int uidRequestCount;
+	// Bit 1 << kind is set for each RequestKind that has rules without a uid
+	unsigned int uidlessKinds;
+	unsigned int argvRequestCount;
+	size_t exeIdentitiesOffset;
+	unsigned int exeCount;
+	size_t cgroupNodesOffset;
+	unsigned int cgroupNodeCount;
+	size_t cgroupEdgesOffset;
+	unsigned int cgroupEdgeCapacity;
+	size_t dfaOffset;
+	size_t dfaSize;
+	size_t namesOffset;
+	size_t namesUsed;
+
+	// Everything from here on describes one load of the set, and is reset in images
+	bool isPrecompiled;
+	// Relative to the set this one was diffed against when it was built. Not computed for images.
+	int added;
+	int removed;
+	int changed;
+	int ignoredLines;
+	int unresolvedRules;
+	long long compileMillis;
+} RuleSet;
+
+RuleSet* allocateRuleSet(const RuleSetSizes* sizes);
+MonitorRequest* addMonitorRequest(RuleSet* this, RequestKind kind, const char* name, int nameLength, unsigned long int duration,
+    const RequestPredicates* predicates);
+void* getPatternDFA(const RuleSet* this);
+void finishRuleSet(RuleSet* this, const RuleSet* base);
+void destroyRuleSet(RuleSet* this);
+bool isRuleSetImage(const void* data, size_t size);
+RuleSet* loadRuleSetImage(const char* path, LogReport* report);
+bool saveRuleSetImage(RuleSet* this, const char* path, LogReport* report);
+
+MonitorRequest* getMonitorRequest(const RuleSet* this, unsigned int index);
+const char* getProcessName(const RuleSet* this, const MonitorRequest* request);
+MonitorRequest* findRequestByName(const RuleSet* this, const char* name);
+MonitorRequest* findEquivalentRequest(const RuleSet* this, const RuleSet* other, const MonitorRequest* request);
+MonitorRequest* findMonitorRequest(const RuleSet* this, Process* process);
+bool isCommCandidate(const char* comm, const void* set);
+#endif
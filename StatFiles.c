@@ -0,0 +1,292 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "StatFiles.h"
+#include "Logging.h"
+#include "Utils.h"
+#include "Process.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "memwatch.h"
+
+// The held files are chained into hash buckets on pid, and into a list from the most to the least recently
+// used. Once as many are held as the fd limit allows, holding another one closes the least recently used.
+// The table grows by doubling up to that limit; unused entries are kept in a free list.
+
+#define MINIMUM_STAT_FILES 64
+// Left for the log, the config, /proc scans and so on
+#define RESERVED_FDS 64
+// Used when there is no fd limit at all
+#define MAX_STAT_FILES 65536
+#define NONE -1
+
+typedef struct
+{
+	pid_t pid;
+	int fd;
+	int bucketNext;
+	int newer;
+	int older;
+} StatFile;
+
+//private
+StatFile* statFiles = NULL;
+int* statBuckets = NULL;
+int statFileCapacity = 0;
+int statFileLimit = 0;
+int heldStatFiles = 0;
+int freeStatFiles = NONE;
+int newestStatFile = NONE;
+int oldestStatFile = NONE;
+
+//private
+// Every monitored process also costs the parent two pipe fds to its worker, so a third of what is left goes
+// to stat files
+int getStatFileLimit()
+{
+    struct rlimit fdLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fdLimit) < 0 || fdLimit.rlim_cur == RLIM_INFINITY
+        || fdLimit.rlim_cur > MAX_STAT_FILES*3 + RESERVED_FDS)
+    {
+        return MAX_STAT_FILES;
+    }
+    if (fdLimit.rlim_cur <= RESERVED_FDS)
+    {
+        return 0;
+    }
+    return (int)(fdLimit.rlim_cur - RESERVED_FDS)/3;
+}
+
+//private
+int* findBucket(pid_t pid)
+{
+    // capacity is a power of 2, and so is the number of buckets
+    return &statBuckets[((unsigned int)pid*2654435761u) & (unsigned int)(statFileCapacity - 1)];
+}
+
+//private
+int findStatFile(pid_t pid)
+{
+    int i = *findBucket(pid);
+    while (i != NONE && statFiles[i].pid != pid)
+    {
+        i = statFiles[i].bucketNext;
+    }
+    return i;
+}
+
+//private
+void unlinkStatFile(int i)
+{
+    if (statFiles[i].newer == NONE)
+    {
+        newestStatFile = statFiles[i].older;
+    }
+    else
+    {
+        statFiles[statFiles[i].newer].older = statFiles[i].older;
+    }
+    if (statFiles[i].older == NONE)
+    {
+        oldestStatFile = statFiles[i].newer;
+    }
+    else
+    {
+        statFiles[statFiles[i].older].newer = statFiles[i].newer;
+    }
+}
+
+//private
+void linkNewestStatFile(int i)
+{
+    statFiles[i].newer = NONE;
+    statFiles[i].older = newestStatFile;
+    if (newestStatFile == NONE)
+    {
+        oldestStatFile = i;
+    }
+    else
+    {
+        statFiles[newestStatFile].newer = i;
+    }
+    newestStatFile = i;
+}
+
+//private
+void removeStatFile(int i)
+{
+    int* link = findBucket(statFiles[i].pid);
+    while (*link != i)
+    {
+        link = &statFiles[*link].bucketNext;
+    }
+    *link = statFiles[i].bucketNext;
+    unlinkStatFile(i);
+    close(statFiles[i].fd);
+    statFiles[i].pid = 0;
+    statFiles[i].bucketNext = freeStatFiles;
+    freeStatFiles = i;
+    --heldStatFiles;
+}
+
+//private
+// Doubles the table, rehashing what is held. Entries keep their index, so the recency list stays valid.
+bool growStatFiles()
+{
+    int newCapacity = statFileCapacity == 0 ? MINIMUM_STAT_FILES : statFileCapacity*2;
+    StatFile* newFiles = (StatFile*)realloc(statFiles, newCapacity*sizeof(StatFile));
+    LogReport report;
+    if (!checkMallocResult(newFiles, &report))
+    {
+        saveLogReport(report);
+        return false;
+    }
+    statFiles = newFiles;
+    int* newBuckets = (int*)realloc(statBuckets, newCapacity*sizeof(int));
+    if (!checkMallocResult(newBuckets, &report))
+    {
+        saveLogReport(report);
+        return false;
+    }
+    statBuckets = newBuckets;
+
+    int oldCapacity = statFileCapacity;
+    statFileCapacity = newCapacity;
+    int i;
+    for (i = 0; i < statFileCapacity; ++i)
+    {
+        statBuckets[i] = NONE;
+    }
+    for (i = 0; i < oldCapacity; ++i)
+    {
+        if (statFiles[i].pid != 0)
+        {
+            int* bucket = findBucket(statFiles[i].pid);
+            statFiles[i].bucketNext = *bucket;
+            *bucket = i;
+        }
+    }
+    for (i = statFileCapacity - 1; i >= oldCapacity; --i)
+    {
+        statFiles[i].pid = 0;
+        statFiles[i].bucketNext = freeStatFiles;
+        freeStatFiles = i;
+    }
+    return true;
+}
+
+// Opens /proc/<pid>/stat to keep, if it isn't already. False if the process is gone, or no fd can be spared.
+bool holdStatFile(pid_t pid)
+{
+    if (statFileCapacity == 0)
+    {
+        statFileLimit = getStatFileLimit();
+    }
+    if (statFileLimit == 0)
+    {
+        return false;
+    }
+    if (statFileCapacity > 0 && findStatFile(pid) != NONE)
+    {
+        return true;
+    }
+    if (heldStatFiles == statFileLimit)
+    {
+        removeStatFile(oldestStatFile);
+    }
+    else if (freeStatFiles == NONE && !growStatFiles())
+    {
+        return false;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    int i = freeStatFiles;
+    freeStatFiles = statFiles[i].bucketNext;
+    statFiles[i].pid = pid;
+    statFiles[i].fd = fd;
+    int* bucket = findBucket(pid);
+    statFiles[i].bucketNext = *bucket;
+    *bucket = i;
+    linkNewestStatFile(i);
+    ++heldStatFiles;
+    return true;
+}
+
+void releaseStatFile(pid_t pid)
+{
+    if (heldStatFiles == 0)
+    {
+        return;
+    }
+    int i = findStatFile(pid);
+    if (i != NONE)
+    {
+        removeStatFile(i);
+    }
+}
+
+// Reads /proc/<pid>/stat into buffer, NUL terminated, and returns the length, or -1 if the process is gone.
+// A held file is read again from the start. Once its process has exited that fails with ESRCH, even if
+// the pid has been reused since, so a failed read is the end of the process: the file is dropped, and the
+// pid isn't looked up again by path. Only pids that weren't held are read by path.
+int readStatFile(pid_t pid, char* buffer, int size)
+{
+    int i = heldStatFiles == 0 ? NONE : findStatFile(pid);
+    if (i != NONE)
+    {
+        int length = (int)pread(statFiles[i].fd, buffer, size - 1, 0);
+        if (length >= 0)
+        {
+            unlinkStatFile(i);
+            linkNewestStatFile(i);
+            buffer[length] = '\0';
+            return length;
+        }
+        removeStatFile(i);
+        return -1;
+    }
+    return readProcFile(pid, "stat", buffer, size);
+}
+
+void closeStatFiles()
+{
+    int i;
+    for (i = 0; i < statFileCapacity; ++i)
+    {
+        if (statFiles[i].pid != 0)
+        {
+            close(statFiles[i].fd);
+        }
+    }
+    free(statFiles);
+    free(statBuckets);
+    statFiles = NULL;
+    statBuckets = NULL;
+    statFileCapacity = 0;
+    heldStatFiles = 0;
+    freeStatFiles = NONE;
+    newestStatFile = NONE;
+    oldestStatFile = NONE;
+}
\ No newline at end of file
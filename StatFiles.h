@@ -0,0 +1,29 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __STAT_FILES_H__
+#define __STAT_FILES_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+// Keeps /proc/<pid>/stat open for the processes being monitored, so that sampling one again is a single
+// pread instead of an open, read and close (and a path lookup).
+bool holdStatFile(pid_t pid);
+void releaseStatFile(pid_t pid);
+int readStatFile(pid_t pid, char* buffer, int size);
+void closeStatFiles();
+#endif
\ No newline at end of file
@@ -0,0 +1,359 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Taskstats.h"
+#include "StatFiles.h"
+#include "Logging.h"
+#include "Utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sysinfo.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include "memwatch.h"
+
+const char* TASKSTATS_ENV_VAR = "PROCNANNYTASKSTATS";
+
+// Talks generic netlink to the TASKSTATS family directly: every reply is a struct taskstats, so nothing is
+// parsed out of text. One socket asks about processes. The other is registered for every CPU, and gets the
+// final accounting of each task as it exits; those are drained once per refresh, to let go of what is kept
+// for processes that are gone.
+//
+// A query for a thread group sums the CPU time of its threads, but leaves out memory and I/O, and a query for
+// its leader has those (memory is shared by the threads anyway), so a process takes one of each.
+
+#define MESSAGE_SIZE 8192
+#define REQUEST_SIZE 256
+
+static bool isTried = false;
+static int queryFD = -1;
+static int exitFD = -1;
+static unsigned short familyId = 0;
+static unsigned int sequence = 0;
+static char message[MESSAGE_SIZE];
+
+//private
+bool isTaskstatsEnabled()
+{
+    const char* enabled = getenv(TASKSTATS_ENV_VAR);
+    return enabled != NULL && compareStrings(enabled, "1");
+}
+
+//private
+int openGenericNetlink()
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct sockaddr_nl local;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//private
+// Sends a generic netlink request with a single attribute
+bool sendRequest(int fd, unsigned short type, unsigned char command, unsigned short attributeType, const void* data,
+    int length)
+{
+    char request[REQUEST_SIZE];
+    if (NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN + NLA_ALIGN(length)) > sizeof(request))
+    {
+        return false;
+    }
+    memset(request, 0, sizeof(request));
+    struct nlmsghdr* header = (struct nlmsghdr*)request;
+    header->nlmsg_type = type;
+    header->nlmsg_flags = NLM_F_REQUEST;
+    header->nlmsg_seq = ++sequence;
+    struct genlmsghdr* genericHeader = (struct genlmsghdr*)NLMSG_DATA(header);
+    genericHeader->cmd = command;
+    genericHeader->version = TASKSTATS_GENL_VERSION;
+    struct nlattr* attribute = (struct nlattr*)((char*)genericHeader + GENL_HDRLEN);
+    attribute->nla_type = attributeType;
+    attribute->nla_len = NLA_HDRLEN + length;
+    memcpy((char*)attribute + NLA_HDRLEN, data, length);
+    header->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(attribute->nla_len));
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    ssize_t sent;
+    do
+    {
+        sent = sendto(fd, request, header->nlmsg_len, 0, (struct sockaddr*)&kernel, sizeof(kernel));
+    }
+    while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t)header->nlmsg_len;
+}
+
+//private
+// The reply to the last request, skipping any left over from earlier ones. NULL if it is an error.
+struct nlmsghdr* receiveReply(int fd)
+{
+    while (true)
+    {
+        ssize_t length = recv(fd, message, sizeof(message), 0);
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        struct nlmsghdr* header = (struct nlmsghdr*)message;
+        if (length < 0 || !NLMSG_OK(header, (unsigned int)length))
+        {
+            return (struct nlmsghdr*)NULL;
+        }
+        if (header->nlmsg_seq != sequence)
+        {
+            continue;
+        }
+        if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+        {
+            return (struct nlmsghdr*)NULL;
+        }
+        return header;
+    }
+}
+
+//private
+struct nlattr* findAttribute(struct nlattr* attribute, int length, unsigned short type)
+{
+    while (length >= NLA_HDRLEN && attribute->nla_len >= NLA_HDRLEN && attribute->nla_len <= length)
+    {
+        if ((attribute->nla_type & NLA_TYPE_MASK) == type)
+        {
+            return attribute;
+        }
+        length -= NLA_ALIGN(attribute->nla_len);
+        attribute = (struct nlattr*)((char*)attribute + NLA_ALIGN(attribute->nla_len));
+    }
+    return (struct nlattr*)NULL;
+}
+
+//private
+struct nlattr* findMessageAttribute(struct nlmsghdr* header, unsigned short type)
+{
+    struct nlattr* attributes = (struct nlattr*)((char*)NLMSG_DATA(header) + GENL_HDRLEN);
+    return findAttribute(attributes, header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), type);
+}
+
+//private
+// The struct taskstats nested in an aggregate attribute. Older kernels send less of it, and the rest is
+// left zeroed; newer ones more, which is cut off.
+bool readAggregateStats(struct nlattr* aggregate, struct taskstats* stats)
+{
+    struct nlattr* found = findAttribute((struct nlattr*)((char*)aggregate + NLA_HDRLEN),
+        aggregate->nla_len - NLA_HDRLEN, TASKSTATS_TYPE_STATS);
+    if (found == NULL)
+    {
+        return false;
+    }
+    size_t length = found->nla_len - NLA_HDRLEN;
+    memset(stats, 0, sizeof(struct taskstats));
+    memcpy(stats, (char*)found + NLA_HDRLEN, length < sizeof(struct taskstats) ? length : sizeof(struct taskstats));
+    return true;
+}
+
+//private
+// The pid or tgid an aggregate attribute is about, or 0
+pid_t readAggregateId(struct nlattr* aggregate, unsigned short type)
+{
+    struct nlattr* found = findAttribute((struct nlattr*)((char*)aggregate + NLA_HDRLEN),
+        aggregate->nla_len - NLA_HDRLEN, type);
+    if (found == NULL || found->nla_len < NLA_HDRLEN + sizeof(unsigned int))
+    {
+        return (pid_t)0;
+    }
+    return (pid_t)*(unsigned int*)((char*)found + NLA_HDRLEN);
+}
+
+//private
+unsigned short resolveTaskstatsFamily()
+{
+    if (!sendRequest(queryFD, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+        sizeof(TASKSTATS_GENL_NAME)))
+    {
+        return 0;
+    }
+    struct nlmsghdr* reply = receiveReply(queryFD);
+    if (reply == NULL)
+    {
+        return 0;
+    }
+    struct nlattr* id = findMessageAttribute(reply, CTRL_ATTR_FAMILY_ID);
+    return id == NULL ? 0 : *(unsigned short*)((char*)id + NLA_HDRLEN);
+}
+
+//private
+// Asks for exits on every CPU. Without it, queries still work.
+void listenForExits()
+{
+    exitFD = openGenericNetlink();
+    if (exitFD < 0)
+    {
+        return;
+    }
+    char cpus[32];
+    snprintf(cpus, sizeof(cpus), "0-%d", get_nprocs_conf() - 1);
+    // Success has no reply, and an error one that handleTaskstatsExits skips
+    if (!sendRequest(exitFD, familyId, TASKSTATS_CMD_GET, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpus, strlen(cpus) + 1))
+    {
+        close(exitFD);
+        exitFD = -1;
+    }
+}
+
+// Connects to the kernel the first time it is called, if PROCNANNYTASKSTATS=1. False if process accounting
+// is to be read from /proc instead: taskstats isn't enabled, or this kernel doesn't have it, or procnanny
+// lacks CAP_NET_ADMIN, which it needs.
+bool startTaskstats()
+{
+    if (isTried)
+    {
+        return familyId != 0;
+    }
+    isTried = true;
+    if (!isTaskstatsEnabled())
+    {
+        return false;
+    }
+
+    queryFD = openGenericNetlink();
+    TaskUsage probe;
+    if (queryFD >= 0)
+    {
+        familyId = resolveTaskstatsFamily();
+    }
+    LogReport report;
+    if (familyId == 0 || !getTaskUsage(getpid(), &probe))
+    {
+        stopTaskstats();
+        report.message = "Taskstats is not available. Reading process accounting from /proc.";
+        report.type = INFO;
+        saveLogReport(report);
+        return false;
+    }
+    listenForExits();
+    report.message = "Reading process accounting through taskstats.";
+    report.type = INFO;
+    saveLogReport(report);
+    return true;
+}
+
+//private
+bool queryTaskstats(unsigned short attributeType, pid_t pid, unsigned short aggregateType, struct taskstats* stats)
+{
+    unsigned int id = (unsigned int)pid;
+    if (!sendRequest(queryFD, familyId, TASKSTATS_CMD_GET, attributeType, &id, sizeof(id)))
+    {
+        return false;
+    }
+    struct nlmsghdr* reply = receiveReply(queryFD);
+    if (reply == NULL)
+    {
+        return false;
+    }
+    struct nlattr* aggregate = findMessageAttribute(reply, aggregateType);
+    return aggregate != NULL && readAggregateStats(aggregate, stats);
+}
+
+// False if the process is gone, or taskstats isn't started
+bool getTaskUsage(pid_t pid, TaskUsage* usage)
+{
+    struct taskstats group;
+    struct taskstats leader;
+    if (familyId == 0
+        || !queryTaskstats(TASKSTATS_CMD_ATTR_TGID, pid, TASKSTATS_TYPE_AGGR_TGID, &group)
+        || !queryTaskstats(TASKSTATS_CMD_ATTR_PID, pid, TASKSTATS_TYPE_AGGR_PID, &leader))
+    {
+        return false;
+    }
+    usage->cpuTime = group.ac_utime + group.ac_stime;
+    usage->elapsed = leader.ac_etime;
+    usage->peakRss = leader.hiwater_rss;
+    usage->peakVsz = leader.hiwater_vm;
+    usage->readBytes = leader.read_bytes;
+    usage->writeBytes = leader.write_bytes;
+    return true;
+}
+
+// Goes through the exits reported since the last call, without waiting for more
+void handleTaskstatsExits()
+{
+    if (exitFD < 0)
+    {
+        return;
+    }
+    ssize_t length;
+    while ((length = recv(exitFD, message, sizeof(message), MSG_DONTWAIT)) > 0 || (length < 0 && errno == ENOBUFS))
+    {
+        if (length < 0)
+        {
+            // Exits came faster than they were read, and some were dropped. Held files of processes that are
+            // gone are still let go of the next time they are read.
+            continue;
+        }
+        struct nlmsghdr* header;
+        for (header = (struct nlmsghdr*)message; NLMSG_OK(header, (unsigned int)length);
+            header = NLMSG_NEXT(header, length))
+        {
+            if (header->nlmsg_type != familyId || header->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+            {
+                continue;
+            }
+            // A thread group that has had more than one thread reports itself as a whole; one that hasn't only
+            // has its leader's exit
+            struct nlattr* aggregate = findMessageAttribute(header, TASKSTATS_TYPE_AGGR_TGID);
+            if (aggregate != NULL)
+            {
+                releaseStatFile(readAggregateId(aggregate, TASKSTATS_TYPE_TGID));
+                continue;
+            }
+            struct taskstats stats;
+            aggregate = findMessageAttribute(header, TASKSTATS_TYPE_AGGR_PID);
+            if (aggregate != NULL && readAggregateStats(aggregate, &stats) && stats.ac_pid == stats.ac_tgid)
+            {
+                releaseStatFile((pid_t)stats.ac_pid);
+            }
+        }
+    }
+}
+
+void stopTaskstats()
+{
+    if (exitFD >= 0)
+    {
+        close(exitFD);
+        exitFD = -1;
+    }
+    if (queryFD >= 0)
+    {
+        close(queryFD);
+        queryFD = -1;
+    }
+    familyId = 0;
+}
\ No newline at end of file
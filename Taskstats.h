@@ -0,0 +1,41 @@
+/*
+Copyright 2015 Udey Rishi
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __TASKSTATS_H__
+#define __TASKSTATS_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+// A process's accounting, as the kernel's taskstats interface has it
+typedef struct
+{
+	// User plus system time over all its threads, and the time since it started, in microseconds
+	unsigned long long cpuTime;
+	unsigned long long elapsed;
+	// High-water marks, in KiB
+	unsigned long long peakRss;
+	unsigned long long peakVsz;
+	// Storage I/O, in bytes
+	unsigned long long readBytes;
+	unsigned long long writeBytes;
+} TaskUsage;
+
+bool startTaskstats();
+bool getTaskUsage(pid_t pid, TaskUsage* usage);
+void handleTaskstatsExits();
+void stopTaskstats();
+#endif
\ No newline at end of file
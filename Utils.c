@@ -19,6 +19,7 @@ limitations under the License.
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 #include "memwatch.h"
 
 bool checkMallocResult(void* pointer, LogReport* report)
@@ -100,4 +101,11 @@ char* getNextStrTokString(char* init)
     char* p = (char*)malloc(sizeof(char)*(len+1));
     strcpy(p, next);
     return p;
+}
+
+long long getMonotonicMillis()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec*1000 + now.tv_nsec/1000000;
 }
\ No newline at end of file
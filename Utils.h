@@ -28,4 +28,5 @@ char* numberStringJoin(int first, const char* second);
 bool compareStrings(const char* first, const char* second);
 char* copyString(char* source);
 char* getNextStrTokString(char* init);
+long long getMonotonicMillis();
 #endif
\ No newline at end of file